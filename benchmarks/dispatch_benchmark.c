@@ -0,0 +1,126 @@
+// Measures RunVm dispatch overhead on loop-heavy scripts.
+// The same source is built once per dispatch strategy (see CMakeLists.txt), so
+// running the resulting executables side by side shows the dispatch speedup.
+// Every script also runs on the register VM for comparison.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+
+#ifndef BENCHMARK_DISPATCH
+#define BENCHMARK_DISPATCH "default"
+#endif
+
+static constexpr int kRepetitions = 25;
+static constexpr double kNanosecondsPerMillisecond = 1e6;
+static constexpr double kMillisecondsPerSecond = 1e3;
+
+typedef struct Script {
+  const char* const kName;
+  const char* const kSource;
+} Script;
+
+static const Script kScripts[] = {
+    {"count-loop",
+     "i: int = 0\n"
+     "while(i < 100000)\n"
+     "  i = i + 1\n"
+     "endwhile"},
+    {"nested-loop",
+     "i: int = 0\n"
+     "s: int = 0\n"
+     "while(i < 300)\n"
+     "  j: int = 0\n"
+     "  while(j < 300)\n"
+     "    s = s + j % 7\n"
+     "    j = j + 1\n"
+     "  endwhile\n"
+     "  i = i + 1\n"
+     "endwhile"},
+    {"for-loop",
+     "s: int = 0\n"
+     "for(i: int = 0; i < 100000; i = i + 1)\n"
+     "  s = s + i * 2 - i\n"
+     "endfor"},
+    {"recursive-fib",
+     "x: int = 0\n"
+     "fib: int = func(n: int)\n"
+     "  if(n < 2)\n"
+     "    ret n\n"
+     "  endif\n"
+     "  ret fib(n - 1) + fib(n - 2)\n"
+     "endfunc\n"
+     "x = fib(20)"},
+};
+
+static void CompileScript(const char* const source) {
+  const size_t kSourceLength = strlen(source);
+
+  ResetLexerState();
+  ResetParserState();
+  ResetInterpreterState();
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memcpy(program_buffer, source, kSourceLength + 1);
+
+  program_buffer_index = 0;
+
+  ParseProgram();
+  EmitHalt();
+}
+
+static double ElapsedMilliseconds(const struct timespec* const start,
+                                  const struct timespec* const end) {
+  return ((double)(end->tv_sec - start->tv_sec) * kMillisecondsPerSecond) +
+         ((double)(end->tv_nsec - start->tv_nsec) / kNanosecondsPerMillisecond);
+}
+
+static void TimeRun(const char* const backend, const char* const script_name,
+                    void (*const run)()) {
+  double best = 0.0;
+  double total = 0.0;
+  int repetition = 0;
+
+  for (repetition = 0; repetition < kRepetitions; ++repetition) {
+    struct timespec start = {};
+    struct timespec end = {};
+    double elapsed = 0.0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = ElapsedMilliseconds(&start, &end);
+    total += elapsed;
+
+    if (0 == repetition || elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  printf("%-9s %-8s %-12s best %8.3f ms  mean %8.3f ms\n", BENCHMARK_DISPATCH,
+         backend, script_name, best, total / kRepetitions);
+}
+
+int main() {
+  size_t script_index = 0;
+
+  for (script_index = 0; script_index < sizeof(kScripts) / sizeof(Script);
+       ++script_index) {
+    CompileScript(kScripts[script_index].kSource);
+
+    TimeRun("stack", kScripts[script_index].kName, RunVm);
+
+    if (GenerateRegisterCode()) {
+      TimeRun("register", kScripts[script_index].kName, RunRegisterVm);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+// Times the phases of whole Yap programs: lexing, parsing and RunVm.
+// Each phase of each program runs many times on a monotonic clock, and the
+// percentiles of the samples are printed as JSON, so runs before and after an
+// interpreter change can be compared by a script. Parsing drives the lexer,
+// so the parse times include lexing.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+
+static constexpr int kRepetitions = 51;
+static constexpr double kNanosecondsPerSecond = 1e9;
+static constexpr int kPercentile = 10;
+static constexpr int kPercent = 100;
+/// Room the generated program leaves in the program buffer.
+static constexpr size_t kGeneratedSourceReserve = 256;
+
+/// A compile-heavy program, generated by GenerateCompileHeavySource.
+static char compile_heavy_source[kProgramBufferSize];
+
+typedef struct Program {
+  const char* const kName;
+  const char* const kSource;
+} Program;
+
+static const Program kPrograms[] = {
+    {"recursion",
+     "x: int = 0\n"
+     "fib: int = func(n: int)\n"
+     "  if(n < 2)\n"
+     "    ret n\n"
+     "  endif\n"
+     "  ret fib(n - 1) + fib(n - 2)\n"
+     "endfunc\n"
+     "x = fib(20)"},
+    {"nested-loops",
+     "i: int = 0\n"
+     "s: int = 0\n"
+     "while(i < 300)\n"
+     "  j: int = 0\n"
+     "  while(j < 300)\n"
+     "    s = s + j % 7\n"
+     "    j = j + 1\n"
+     "  endwhile\n"
+     "  i = i + 1\n"
+     "endwhile"},
+    // Element stores run in a function, whose frame takes the value an
+    // assignment to an element leaves on the stack.
+    {"array-traffic",
+     "a: array = $1, 2, 3, 4, 5, 6, 7, 8&\n"
+     "bump: int = func(k: int)\n"
+     "  a$k& = a$k& + 1\n"
+     "  ret a$k&\n"
+     "endfunc\n"
+     "i: int = 0\n"
+     "s: int = 0\n"
+     "while(i < 20000)\n"
+     "  s = s + bump(i % 8) + a$(i + 3) % 8&\n"
+     "  i = i + 1\n"
+     "endwhile"},
+    {"print-heavy",
+     "i: int = 0\n"
+     "while(i < 5000)\n"
+     "  print(i)\n"
+     "  print(\"line\")\n"
+     "  i = i + 1\n"
+     "endwhile"},
+    {"compile-heavy", compile_heavy_source},
+};
+
+/// Fills compile_heavy_source with small functions and the globals they
+/// initialize, close to the size of the program buffer. It defines no more
+/// functions than the VM holds.
+static void GenerateCompileHeavySource() {
+  size_t length = 0;
+  int index = 0;
+
+  while (length + kGeneratedSourceReserve < sizeof(compile_heavy_source) &&
+         index < kFunctionPoolSize) {
+    length += (size_t)snprintf(
+        &compile_heavy_source[length], sizeof(compile_heavy_source) - length,
+        "f%d: int = func(n: int)\n"
+        "  ret n * %d + %d\n"
+        "endfunc\n"
+        "v%d: int = f%d(%d) - %d\n",
+        index, index % 9 + 1, index, index, index, index, index % 5);
+    ++index;
+  }
+}
+
+static double ElapsedNanoseconds(const struct timespec* const start,
+                                 const struct timespec* const end) {
+  return ((double)(end->tv_sec - start->tv_sec) * kNanosecondsPerSecond) +
+         (double)(end->tv_nsec - start->tv_nsec);
+}
+
+static void LoadSource(const char* const source) {
+  ResetLexerState();
+  ResetParserState();
+  ResetInterpreterState();
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memcpy(program_buffer, source, strlen(source) + 1);
+
+  program_buffer_index = 0;
+}
+
+static double TimeLex(const char* const source) {
+  struct timespec start = {};
+  struct timespec end = {};
+
+  LoadSource(source);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (ConsumeNextToken(); kTokenEof != token.type; ConsumeNextToken()) {
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ElapsedNanoseconds(&start, &end);
+}
+
+static double TimeParse(const char* const source) {
+  struct timespec start = {};
+  struct timespec end = {};
+
+  LoadSource(source);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ParseProgram();
+  EmitHalt();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ElapsedNanoseconds(&start, &end);
+}
+
+/// Runs the program the last TimeParse compiled.
+static double TimeRun(const char* const source) {
+  struct timespec start = {};
+  struct timespec end = {};
+
+  (void)source;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  RunVm();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ElapsedNanoseconds(&start, &end);
+}
+
+static int CompareSamples(const void* const left, const void* const right) {
+  const double kLeft = *(const double*)left;
+  const double kRight = *(const double*)right;
+
+  return (kLeft > kRight) - (kLeft < kRight);
+}
+
+/// Returns the sample at `percent` of the sorted samples, by nearest rank.
+static double Percentile(const double* const samples, const int percent) {
+  return samples[(kRepetitions - 1) * percent / kPercent];
+}
+
+/// Times a phase kRepetitions times and prints the percentiles of its
+/// duration and throughput. Throughput is `work` units per second.
+static void MeasurePhase(FILE* const output, const char* const phase_name,
+                         double (*const phase)(const char*),
+                         const char* const source, const double work,
+                         const char* const unit) {
+  double samples[kRepetitions];
+  int repetition = 0;
+
+  for (repetition = 0; repetition < kRepetitions; ++repetition) {
+    samples[repetition] = phase(source);
+  }
+
+  qsort(samples, kRepetitions, sizeof(double), CompareSamples);
+
+  fprintf(output,
+          "      \"%s\": {\"min_ns\": %.0f, \"p%d_ns\": %.0f, "
+          "\"median_ns\": %.0f, \"p%d_ns\": %.0f, \"max_ns\": %.0f, "
+          "\"median_%s_per_second\": %.1f, \"p%d_%s_per_second\": %.1f}",
+          phase_name, samples[0], kPercentile,
+          Percentile(samples, kPercentile), Percentile(samples, kPercent / 2),
+          kPercent - kPercentile, Percentile(samples, kPercent - kPercentile),
+          samples[kRepetitions - 1], unit,
+          work * kNanosecondsPerSecond / Percentile(samples, kPercent / 2),
+          kPercent - kPercentile, unit,
+          work * kNanosecondsPerSecond /
+              Percentile(samples, kPercent - kPercentile));
+}
+
+int main() {
+  FILE* output = nullptr;
+  size_t index = 0;
+
+  GenerateCompileHeavySource();
+
+  // The JSON goes to the original standard output, the programs print into
+  // the void.
+  output = fdopen(dup(STDOUT_FILENO), "w");
+
+  if (nullptr == output || nullptr == freopen("/dev/null", "w", stdout)) {
+    fputs("Error: Cannot redirect the program output.\n", stderr);
+
+    return EXIT_FAILURE;
+  }
+
+  fprintf(output, "{\n  \"repetitions\": %d,\n  \"programs\": [\n",
+          kRepetitions);
+
+  for (index = 0; index < sizeof(kPrograms) / sizeof(Program); ++index) {
+    const char* const kSource = kPrograms[index].kSource;
+    const double kSourceSize = (double)strlen(kSource);
+
+    TimeParse(kSource);
+
+    if (is_compile_error) {
+      fprintf(stderr, "Error: '%s' does not compile.\n",
+              kPrograms[index].kName);
+
+      return EXIT_FAILURE;
+    }
+
+    fprintf(output,
+            "    {\n      \"name\": \"%s\",\n      \"source_bytes\": %.0f,\n"
+            "      \"instruction_bytes\": %zu,\n",
+            kPrograms[index].kName, kSourceSize, instruction_address);
+
+    MeasurePhase(output, "lex", TimeLex, kSource, kSourceSize, "bytes");
+    fputs(",\n", output);
+    MeasurePhase(output, "parse", TimeParse, kSource, kSourceSize, "bytes");
+    fputs(",\n", output);
+    MeasurePhase(output, "run", TimeRun, kSource, 1.0, "runs");
+    fprintf(output, "\n    }%s\n",
+            index + 1 < sizeof(kPrograms) / sizeof(Program) ? "," : "");
+  }
+
+  fputs("  ]\n}\n", output);
+  fclose(output);
+
+  return EXIT_SUCCESS;
+}
@@ -1,93 +1,202 @@
-; Use CIA 1 as a timer to benchmark function calls
+; Use CIA 1 as a 32-bit timer to benchmark sections of the interpreter
 ; See https://www.c64-wiki.com/wiki/CIA
 
 .autoimport on
-.importzp sp
-.import _printf
+.importzp sreg
 
-.export _StartTimerA
-.export _StopTimerA
+.export _StartTimer
+.export _ReadTimer
+.export _StartSection
+.export _StopSection
+.export _GetSectionTicks
+.export _ClearSections
 
-.segment "RODATA"
-
-ticks_string:
-    .byte "%U ticks",$0d,$00    ; "%u ticks\r\0"
+SECTION_COUNT = 4               ; Must match kSectionCount in benchmark.h
 
 .segment "CODE"
 
 ; ---------------------------------------------------------------
-; void __near__ StartTimerA (void)
+; void __near__ StartTimer (void)
 ; ---------------------------------------------------------------
 
-.proc _StartTimerA: near
-; Stop Timer A
-    lda #$00    ; Load 0x00 into A register
-    sta $dc0e   ; Stop Timer A by setting all control bits to 0
+.proc _StartTimer: near
+; Stop Timer A and Timer B, keeping the time of day clock frequency in bit 7
+    lda $dc0e               ; Load Timer A control register into A register
+    and #$80                ; Clear all control bits but bit 7
+    sta $dc0e               ; Stop Timer A
+    lda #$00                ; Load 0x00 into A register
+    sta $dc0f               ; Stop Timer B by setting all control bits to 0
+
+; Set Timer A and Timer B start values
+    lda #$ff                ; Load 0xff into A register
+    sta $dc04               ; Set Timer A low byte to 0xff
+    sta $dc05               ; Set Timer A high byte to 0xff
+    sta $dc06               ; Set Timer B low byte to 0xff
+    sta $dc07               ; Set Timer B high byte to 0xff
+
+; Start Timer B first, so it sees every underflow of Timer A
+    lda #$51                ; Load 0101 0001 into A register. Bits 6-5 = 10: Count Timer A underflows, bit 4 high: load start value, bit 0 high: start Timer B
+    sta $dc0f               ; Load configuration into Timer B
+    lda $dc0e               ; Load Timer A control register into A register
+    ora #$11                ; Set bit 4 high: load start value, bit 0 high: start Timer A counting system clock cycles
+    sta $dc0e               ; Load configuration into Timer A
+    jmp _ClearSections      ; Clear the section table and return
+.endproc
 
-; Set Timer A start value
-    lda #$ff    ; Load 0xff into A register
-    sta $dc04   ; Set Timer A low byte to 0xff
-    sta $dc05   ; Set Timer A high byte to 0xff
+; ---------------------------------------------------------------
+; unsigned long __near__ ReadTimer (void)
+; ---------------------------------------------------------------
 
-; Set Timer A configuration
-    lda #$81    ; Load 1000 0001 into A register. Bit 7 high: Start Timer A, bit 0 high: 50 Hz clock speed
-    sta $dc0e   ; Load configuration into Timer A
+.proc _ReadTimer: near
+; Read Timer B as the high word and Timer A as the low word of the 32-bit count without stopping them
+retry:
+    lda $dc06               ; Load Timer B value low byte into A register
+    sta count+2             ; Store it in count+2
+    lda $dc07               ; Load Timer B value high byte into A register
+    sta count+3             ; Store it in count+3
+    lda $dc05               ; Load Timer A value high byte into A register
+    sta count+1             ; Store it in count+1
+    lda $dc04               ; Load Timer A value low byte into A register
+    sta count               ; Store it in count
+    lda $dc05               ; Load Timer A value high byte again
+    cmp count+1             ; It changes when the low byte wraps around between the two reads
+    bne retry               ; Read again if it did
+    lda $dc06               ; Load Timer B value low byte again
+    cmp count+2             ; It changes when Timer A underflows or Timer B's low byte wraps around while reading
+    bne retry               ; Read again if it did
+
+; Both timers count down from 0xffff, so (0xffffffff - count) = ~count is the number of ticks since StartTimer
+    lda count+3             ; Load count byte 3 into A register
+    eor #$ff                ; Byte 3 XOR 0xff = byte 3 one's complement
+    sta sreg+1              ; Return byte 3 in sreg+1
+    lda count+2             ; Load count byte 2 into A register
+    eor #$ff                ; Byte 2 XOR 0xff = byte 2 one's complement
+    sta sreg                ; Return byte 2 in sreg
+    lda count+1             ; Load count byte 1 into A register
+    eor #$ff                ; Byte 1 XOR 0xff = byte 1 one's complement
+    tax                     ; Return byte 1 in X register
+    lda count               ; Load count byte 0 into A register
+    eor #$ff                ; Byte 0 XOR 0xff = byte 0 one's complement, returned in A register
     rts
 .endproc
 
 ; ---------------------------------------------------------------
-; void __near__ StopTimerA (void)
+; void __near__ StartSection (unsigned char section)
 ; ---------------------------------------------------------------
 
-.proc _StopTimerA: near
-; Stop Timer A by setting control bit 7 to low while keeping the other control bits intact
-    lda $dc0e               ; Load Timer A control register into A register
-    and #$7f                ; AND control bits with 0111 1111 (stop Timer A)
-    sta $dc0e               ; Stop Timer A
+.proc _StartSection: near
+; Each section takes 4 bytes in the tables
+    asl a                   ; Multiply section in A register by 2
+    asl a                   ; Multiply section by 2 again
+    sta offset              ; Store the table offset in offset
+
+; Store the current ticks as the start of the section
+    jsr _ReadTimer          ; Read the ticks into A, X, sreg and sreg+1
+    ldy offset              ; Load the table offset into Y register
+    sta starts,y            ; Store ticks byte 0
+    txa                     ; Transfer ticks byte 1 into A register
+    sta starts+1,y          ; Store ticks byte 1
+    lda sreg                ; Load ticks byte 2 into A register
+    sta starts+2,y          ; Store ticks byte 2
+    lda sreg+1              ; Load ticks byte 3 into A register
+    sta starts+3,y          ; Store ticks byte 3
+    rts
+.endproc
 
-; Read Timer A 16-bit value from $dc04 and $dc05 and store it in tmp1 and tmp1+1
-    lda $dc04               ; Load Timer A value low byte into A register
-    sta tmp1                ; Store Timer A value low byte in tmp1
-    lda $dc05               ; Read Timer A value high byte into A register
-    sta tmp1+1              ; Store Timer A value high byte in tmp1+1
-
-; Subtract Timer A 16-bit value from 0xffff to get the difference (result)
-; We will use the one's complement plus one method: (0xffff - x) = (~x + 1)
-    lda tmp1                ; Load Timer A value low byte into A register
-    eor #$ff                ; Low byte XOR 0xff = low byte one's complement
-    sta res1                ; Store Timer A value low byte one's complement in res1
-    lda tmp1+1              ; Load Timer A value high byte into A register
-    eor #$ff                ; High byte XOR 0xff = high byte one's complement
-    sta res1+1              ; Store Timer A value high byte one's complement in res1+1
-
-; Add 1 to result. If res1 is 0xff, the carry flag will be set and res1+1 needs to be incremented too
+; ---------------------------------------------------------------
+; void __near__ StopSection (unsigned char section)
+; ---------------------------------------------------------------
+
+.proc _StopSection: near
+    asl a                   ; Multiply section in A register by 2
+    asl a                   ; Multiply section by 2 again
+    sta offset              ; Store the table offset in offset
+
+; Store the current ticks in count
+    jsr _ReadTimer          ; Read the ticks into A, X, sreg and sreg+1
+    sta count               ; Store ticks byte 0
+    stx count+1             ; Store ticks byte 1
+    lda sreg                ; Load ticks byte 2 into A register
+    sta count+2             ; Store ticks byte 2
+    lda sreg+1              ; Load ticks byte 3 into A register
+    sta count+3             ; Store ticks byte 3
+
+; Subtract the start of the section from count
+    ldy offset              ; Load the table offset into Y register
+    sec                     ; Set carry flag: No borrow
+    lda count               ; Load count byte 0 into A register
+    sbc starts,y            ; Subtract start byte 0
+    sta count               ; Store elapsed ticks byte 0
+    lda count+1             ; Load count byte 1 into A register
+    sbc starts+1,y          ; Subtract start byte 1 with borrow
+    sta count+1             ; Store elapsed ticks byte 1
+    lda count+2             ; Load count byte 2 into A register
+    sbc starts+2,y          ; Subtract start byte 2 with borrow
+    sta count+2             ; Store elapsed ticks byte 2
+    lda count+3             ; Load count byte 3 into A register
+    sbc starts+3,y          ; Subtract start byte 3 with borrow
+    sta count+3             ; Store elapsed ticks byte 3
+
+; Add the elapsed ticks to the total of the section
     clc                     ; Clear carry flag
-    inc res1                ; Increment value low byte
-    bne done                ; If carry is zero: Go to done, otherwise go to next line.
-    inc res1+1              ; Increment value high byte
-
-; Push format format string low and high bytes onto stack
-done:
-    lda #<(ticks_string)    ; Load format string low byte into A register
-    ldx #>(ticks_string)    ; Load format string high byte into A register
-    jsr pushax              ; Push format string low and high bytes onto stack
-
-; Push Timer A value low and high bytes onto stack
-    lda res1                ; Load Timer A value low byte into A register
-    ldx res1+1              ; Load Timer A value high byte into X register
-    jsr pushax              ; Push Timer A value low and high bytes onto stack
-
-; Call printf, pop 4 bytes off stack and return
-    ldy #$04                ; Load 0x04 into Y register: Tell printf there are 4 bytes of data to print (16-bit value, \r, \0)
-    jsr _printf             ; Call printf
-    jmp incsp1              ; Cleanup
+    lda totals,y            ; Load total byte 0 into A register
+    adc count               ; Add elapsed ticks byte 0
+    sta totals,y            ; Store total byte 0
+    lda totals+1,y          ; Load total byte 1 into A register
+    adc count+1             ; Add elapsed ticks byte 1 with carry
+    sta totals+1,y          ; Store total byte 1
+    lda totals+2,y          ; Load total byte 2 into A register
+    adc count+2             ; Add elapsed ticks byte 2 with carry
+    sta totals+2,y          ; Store total byte 2
+    lda totals+3,y          ; Load total byte 3 into A register
+    adc count+3             ; Add elapsed ticks byte 3 with carry
+    sta totals+3,y          ; Store total byte 3
+    rts
+.endproc
 
-.segment "BSS"
+; ---------------------------------------------------------------
+; unsigned long __near__ GetSectionTicks (unsigned char section)
+; ---------------------------------------------------------------
 
-tmp1:
-    .res 2,$00  ; Reserve 2 bytes of zeros
+.proc _GetSectionTicks: near
+    asl a                   ; Multiply section in A register by 2
+    asl a                   ; Multiply section by 2 again
+    tay                     ; Transfer the table offset into Y register
+
+; Return the total of the section in A, X, sreg and sreg+1
+    lda totals+3,y          ; Load total byte 3 into A register
+    sta sreg+1              ; Return byte 3 in sreg+1
+    lda totals+2,y          ; Load total byte 2 into A register
+    sta sreg                ; Return byte 2 in sreg
+    ldx totals+1,y          ; Return byte 1 in X register
+    lda totals,y            ; Return byte 0 in A register
+    rts
+.endproc
 
-res1:
-    .res 2,$00  ; Reserve 2 bytes of zeros
+; ---------------------------------------------------------------
+; void __near__ ClearSections (void)
+; ---------------------------------------------------------------
 
+.proc _ClearSections: near
+    ldy #SECTION_COUNT*4-1  ; Load the offset of the last total byte into Y register
+    lda #$00                ; Load 0x00 into A register
+loop:
+    sta totals,y            ; Clear total byte
+    dey                     ; Go to the previous byte
+    bpl loop                ; Repeat until all bytes are cleared
+    rts
 .endproc
+
+.segment "BSS"
+
+count:
+    .res 4,$00                  ; Reserve 4 bytes of zeros
+
+offset:
+    .res 1,$00                  ; Reserve 1 byte of zeros
+
+starts:
+    .res SECTION_COUNT*4,$00    ; Reserve 4 bytes of zeros per section
+
+totals:
+    .res SECTION_COUNT*4,$00    ; Reserve 4 bytes of zeros per section
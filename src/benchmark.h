@@ -8,7 +8,32 @@
 #define __near__
 #endif
 
-void __near__ StartTimerA();
-void __near__ StopTimerA();
+/// Sections of the interpreter with their own tick total. The order matches
+/// the tables in benchmark.asm.
+typedef enum BenchmarkSection {
+  kSectionLex,
+  kSectionParse,
+  kSectionRun,
+  kSectionPrint,
+  kSectionCount
+} BenchmarkSection;
+
+/// Starts CIA 1 Timer A counting system clock cycles and Timer B counting the
+/// underflows of Timer A, which makes a 32-bit timer, and clears the section
+/// totals.
+void __near__ StartTimer();
+
+/// Returns the ticks since StartTimer.
+unsigned long __near__ ReadTimer();
+
+/// Starts timing `section`. Sections may overlap.
+void __near__ StartSection(unsigned char section);
+
+/// Adds the ticks since StartSection to the total of `section`.
+void __near__ StopSection(unsigned char section);
+
+unsigned long __near__ GetSectionTicks(unsigned char section);
+
+void __near__ ClearSections();
 
 #endif  // BENCHMARK_H
@@ -1,6 +1,5 @@
 #include "lexer.h"
 
-#include <ctype.h>
 #include <stdarg.h>
 #ifdef __CC65__
 #include <stdbool.h>
@@ -9,13 +8,57 @@
 #include <stddef.h>
 #endif
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
+#if defined(__CC65__) && !defined(NDEBUG)
+#include "benchmark.h"
+#endif
+
+#ifdef __CC65__
+enum {
+  kIdentifierTableSize = 256,
+  kIdentifierPoolSize = 1024,
+  kSourceWindowSize = 256,
+  kTokenLengthMax = 80
+};
+#else
+static constexpr size_t kIdentifierTableSize = 2048;
+static constexpr size_t kIdentifierPoolSize = 16384;
+static constexpr size_t kSourceWindowSize = 4096;
+static constexpr size_t kTokenLengthMax = 1024;
+#endif
+
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
 Token token;
 char program_buffer[kProgramBufferSize];
+const char* program_source = program_buffer;
 size_t program_buffer_index = 0;
+bool is_compile_error = false;
+bool is_error_silenced = false;
+
+/// Open addressing hash table of the interned identifiers. A slot holds the
+/// id plus one, or zero if it is empty. It has twice as many slots as there
+/// are ids, so a probe always ends at an empty slot.
+static size_t identifier_table[kIdentifierTableSize];
+/// Names of the interned identifiers, each terminated by '\0'.
+static char identifier_pool[kIdentifierPoolSize];
+static size_t identifier_offsets[kIdentifiersSize];
+static size_t identifier_count = 0;
+static size_t identifier_pool_index = 0;
+
+/// Size of program_source including its terminator.
+static size_t program_source_size = kProgramBufferSize;
+/// Position of program_source[0] in the whole source. Only a streamed source
+/// moves it.
+static size_t program_source_base = 0;
+
+/// A streamed source is read into this window piece by piece. Tokens in it
+/// are at most kTokenLengthMax characters long.
+static char source_window[kSourceWindowSize];
+static SourceReader source_reader;
+/// Set once the reader returned the last of the source, and for a source
+/// that is in memory as a whole.
+static bool is_source_end = true;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 typedef struct KeywordEntry {
@@ -23,49 +66,210 @@ typedef struct KeywordEntry {
   const TokenType kType;
 } KeywordEntry;
 
-static const KeywordEntry kKeywordMap[] = {
-    {"print", kTokenPrint},      {"if", kTokenIf},
-    {"else", kTokenElse},        {"endif", kTokenEndif},
-    {"for", kTokenFor},          {"endfor", kTokenEndfor},
-    {"local", kTokenLocal},      {"func", kTokenFunc},
-    {"endfunc", kTokenEndfunc},  {"ret", kTokenRet},
-    {"int", kTokenInt},          {"float", kTokenFloat},
-    {"str", kTokenStr},          {"bool", kTokenBool},
-    {"array", kTokenArray},      {"while", kTokenWhile},
-    {"endwhile", kTokenEndwhile}};
-
 #ifdef __CC65__
-static const size_t kKeywordCount = sizeof(kKeywordMap) / sizeof(KeywordEntry);
+enum { kKeywordTableSize = 32 };
 #else
-static constexpr size_t kKeywordCount =
-    sizeof(kKeywordMap) / sizeof(KeywordEntry);
+static constexpr size_t kKeywordTableSize = 32;
+#endif
+
+/// Keywords and boolean literals, each at the slot KeywordHash() gives it.
+/// The hash has no collisions for this set, so a lookup is one hash and one
+/// string compare. Empty slots hold "", which no identifier matches.
+static const KeywordEntry kKeywordTable[kKeywordTableSize] = {
+    {"", kTokenIdentifier},    {"", kTokenIdentifier},
+    {"int", kTokenInt},        {"", kTokenIdentifier},
+    {"bool", kTokenBool},      {"", kTokenIdentifier},
+    {"endfor", kTokenEndfor},  {"while", kTokenWhile},
+    {"for", kTokenFor},        {"", kTokenIdentifier},
+    {"ret", kTokenRet},        {"array", kTokenArray},
+    {"", kTokenIdentifier},    {"true", kTokenBoolean},
+    {"float", kTokenFloat},    {"", kTokenIdentifier},
+    {"str", kTokenStr},        {"", kTokenIdentifier},
+    {"if", kTokenIf},          {"", kTokenIdentifier},
+    {"", kTokenIdentifier},    {"else", kTokenElse},
+    {"local", kTokenLocal},    {"", kTokenIdentifier},
+    {"endif", kTokenEndif},    {"endfunc", kTokenEndfunc},
+    {"", kTokenIdentifier},    {"func", kTokenFunc},
+    {"", kTokenIdentifier},    {"endwhile", kTokenEndwhile},
+    {"print", kTokenPrint},    {"false", kTokenBoolean}};
+/// Classes of kCharacterClass that are not a one-character token. They lie
+/// above every TokenType.
+enum CharacterClass {
+  kClassNone = 0,
+  kClassSpace = 0x80,
+  kClassDigit,
+  kClassLetter,
+  kClassQuote
+};
+
+/// Class of every character, or the token type if the character is a token
+/// on its own. For '=', '!', '<' and '>' that is the token without a
+/// following '='.
+static const unsigned char kCharacterClass[256] = {
+    // 0x00
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassSpace, kClassSpace, kClassSpace,
+    kClassSpace, kClassSpace, kClassNone, kClassNone,
+    // 0x10
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0x20
+    kClassSpace, kTokenNot, kClassQuote, kClassNone, kTokenLeftBracket,
+    kTokenPercent, kTokenRightBracket, kClassNone, kTokenLeftParenthesis,
+    kTokenRightParenthesis, kTokenStar, kTokenPlus, kTokenComma, kTokenMinus,
+    kTokenDot, kTokenSlash,
+    // 0x30
+    kClassDigit, kClassDigit, kClassDigit, kClassDigit, kClassDigit,
+    kClassDigit, kClassDigit, kClassDigit, kClassDigit, kClassDigit,
+    kTokenColon, kTokenSemicolon, kTokenLessThan, kTokenAssign,
+    kTokenGreaterThan, kClassNone,
+    // 0x40
+    kClassNone, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter,
+    // 0x50
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0x60
+    kClassNone, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter,
+    // 0x70
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+#ifdef __CC65__
+    // Shifted PETSCII letters
+    // 0x80
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0x90
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0xA0
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0xB0
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
+    kClassNone, kClassNone, kClassNone, kClassNone,
+    // 0xC0
+    kClassNone, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter,
+    // 0xD0
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassLetter, kClassLetter, kClassLetter, kClassLetter,
+    kClassLetter, kClassNone, kClassNone, kClassNone, kClassNone, kClassNone,
 #endif
+};
 
+/// The source is always terminated by '\0', so nothing behind it is read.
 void ResetLexerState() {
-  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  memset(program_buffer, 0, kProgramBufferSize);
+  program_buffer[0] = '\0';
+
+  SetProgramSource(program_buffer, kProgramBufferSize);
+  ResetIdentifiers();
+}
 
+void SetProgramSource(const char* const source, const size_t size) {
+  program_source = source;
+  program_source_size = size;
+  program_source_base = 0;
   program_buffer_index = 0;
+  is_source_end = true;
 }
 
-static void IncrementProgramBufferIndex() {
-  if (kProgramBufferSize < program_buffer_index) {
-    puts("Error: Program buffer overflow.");
+void SetProgramReader(const SourceReader reader) {
+  source_window[0] = '\0';
 
-    return;
+  SetProgramSource(source_window, 1);
+
+  source_reader = reader;
+  is_source_end = false;
+}
+
+/// Slides the window of a streamed source up to program_buffer_index and reads
+/// the text behind it, so that a whole token is in the window. The text of a
+/// string token stays, since the parser uses it after lexing the next token.
+/// Moving program_buffer_index back in front of the window reads it again.
+static void FillSourceWindow() {
+  const size_t kWindowEnd = program_source_base + program_source_size - 1;
+  size_t keep = program_buffer_index;
+  size_t kept = 0;
+  size_t read = 0;
+
+  if (program_buffer_index < program_source_base ||
+      kWindowEnd < program_buffer_index) {
+    is_source_end = false;
+  } else {
+    if (is_source_end || kTokenLengthMax <= kWindowEnd - program_buffer_index) {
+      return;
+    }
+
+    if (kTokenString == token.type && program_source_base <= token.start &&
+        token.start < keep) {
+      keep = token.start;
+    }
+
+    kept = kWindowEnd - keep;
+
+    if (kSourceWindowSize - kTokenLengthMax <= kept) {
+      ReportError("Error: Line too long.\n");
+
+      is_source_end = true;
+
+      return;
+    }
+
+    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+    memmove(source_window, &source_window[keep - program_source_base], kept);
   }
 
-  ++program_buffer_index;
+  read = source_reader(keep + kept, &source_window[kept],
+                       kSourceWindowSize - 1 - kept);
+
+  is_source_end = kSourceWindowSize - 1 - kept != read;
+  source_window[kept + read] = '\0';
+  program_source_base = keep;
+  program_source_size = kept + read + 1;
 }
 
-static void DecrementProgramBufferIndex() {
-  if (0 == program_buffer_index) {
-    puts("Error: Program buffer underflow.");
+/// Empties the slots of the interned identifiers only. Going from the newest
+/// id back, the probe sequence of each one is still intact.
+void ResetIdentifiers() {
+  const char* name = identifier_pool;
+  size_t hash = 0;
 
-    return;
+  while (0 != identifier_count) {
+    --identifier_count;
+
+    // The same hash as LexWord computes.
+    hash = 0;
+
+    for (name = &identifier_pool[identifier_offsets[identifier_count]];
+         '\0' != *name; ++name) {
+      hash = (hash << 5) + hash + (unsigned char)*name;
+    }
+
+    hash &= kIdentifierTableSize - 1;
+
+    while (identifier_count + 1 != identifier_table[hash]) {
+      hash = (hash + 1) & (kIdentifierTableSize - 1);
+    }
+
+    identifier_table[hash] = 0;
   }
 
-  --program_buffer_index;
+  identifier_pool_index = 0;
 }
 
 bool __cdecl__ AcceptTokenImplementation(const size_t token_type_list_length,
@@ -99,276 +303,246 @@ bool __cdecl__ AcceptTokenImplementation(const size_t token_type_list_length,
   return false;
 }
 
-static void SkipWhitespace() {
-  while (program_buffer[program_buffer_index] &&
-         isspace(program_buffer[program_buffer_index])) {
-    IncrementProgramBufferIndex();
-  }
+/// Perfect hash of the keyword table, see kKeywordTable.
+static size_t KeywordHash(const char* const text, const size_t length) {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+  return ((size_t)(unsigned char)text[0] * 8U +
+          (size_t)(unsigned char)text[length - 1] + length * 2U) &
+         (kKeywordTableSize - 1);
 }
 
-static bool IsString() {
-  int length = 0;
+/// Sets the token to the keyword or boolean literal spelled by the `length`
+/// characters at `text`. Returns false if they are an ordinary identifier.
+static bool IsKeyword(const char* const text, const size_t length) {
+  const KeywordEntry* const kEntry = &kKeywordTable[KeywordHash(text, length)];
 
-  if ('"' != program_buffer[program_buffer_index]) {
+  if (0 != strncmp(text, kEntry->kText, length) ||
+      '\0' != kEntry->kText[length]) {
     return false;
   }
 
-  IncrementProgramBufferIndex();
-
-  while (program_buffer[program_buffer_index] &&
-         '"' != program_buffer[program_buffer_index]) {
-    if (length < sizeof(token.value.text) - 1) {
-      token.value.text[length++] = program_buffer[program_buffer_index];
-    }
-
-    IncrementProgramBufferIndex();
-  }
-
-  token.value.text[length] = '\0';
+  token.type = kEntry->kType;
 
-  if ('"' == program_buffer[program_buffer_index]) {
-    IncrementProgramBufferIndex();
+  if (kTokenBoolean == kEntry->kType) {
+    token.number = 't' == text[0];
   }
 
-  token.type = kTokenString;
-
   return true;
 }
 
-static bool IsCharacter() {
-  switch (program_buffer[program_buffer_index]) {
-    case '=':
-      IncrementProgramBufferIndex();
+static const char* LexString(const char* character) {
+  // Skip the opening quote.
+  const char* const kText = ++character;
 
-      if ('=' == program_buffer[program_buffer_index]) {
-        token.type = kTokenEquals;
-
-        break;
-      }
-
-      token.type = kTokenAssign;
-
-      DecrementProgramBufferIndex();
-
-      break;
-    case '!':
-      IncrementProgramBufferIndex();
-
-      if ('=' == program_buffer[program_buffer_index]) {
-        token.type = kTokenNotEquals;
-
-        break;
-      }
-
-      token.type = kTokenNot;
-
-      DecrementProgramBufferIndex();
-
-      break;
-    case '(':
-      token.type = kTokenLeftParenthesis;
-
-      break;
-    case ')':
-      token.type = kTokenRightParenthesis;
-
-      break;
-    case '+':
-      token.type = kTokenPlus;
-
-      break;
-    case '-':
-      token.type = kTokenMinus;
-
-      break;
-    case '*':
-      token.type = kTokenStar;
-
-      break;
-    case '%':
-      token.type = kTokenPercent;
-
-      break;
-    case '/':
-      token.type = kTokenSlash;
-
-      break;
-    case ':':
-      token.type = kTokenColon;
+  token.type = kTokenString;
+  token.start = program_source_base + (size_t)(kText - program_source);
 
-      break;
-    case ';':
-      token.type = kTokenSemicolon;
+  while ('"' != *character && '\0' != *character) {
+    ++character;
+  }
 
-      break;
-    case '>':
-      IncrementProgramBufferIndex();
+  token.length = (size_t)(character - kText);
 
-      if ('=' == program_buffer[program_buffer_index]) {
-        token.type = kTokenGreaterOrEquals;
+  if ('"' == *character) {
+    ++character;
+  }
 
-        break;
-      }
+  return character;
+}
 
-      token.type = kTokenGreaterThan;
+static const char* LexNumber(const char* character) {
+#ifdef __CC65__
+  static const unsigned kBase = 10;
+#else
+  static constexpr unsigned kBase = 10;
+#endif
 
-      DecrementProgramBufferIndex();
+  unsigned number = 0;
 
-      break;
-    case '<':
-      IncrementProgramBufferIndex();
+  do {
+    number = number * kBase + (unsigned)(*character - '0');
+    ++character;
+  } while (kClassDigit == kCharacterClass[(unsigned char)*character]);
 
-      if ('=' == program_buffer[program_buffer_index]) {
-        token.type = kTokenLessOrEquals;
+  token.type = kTokenNumber;
+  token.number = (int)number;
 
-        break;
-      }
+  return character;
+}
 
-      token.type = kTokenLessThan;
+/// Lexes an identifier, keyword or boolean literal.
+/// Returns the id of the identifier, which is interned on its first
+/// occurrence, or (size_t)-1 if there is no room left for it.
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static size_t InternIdentifier(const char* const text, const size_t length,
+                               size_t hash) {
+  size_t id = 0;
 
-      DecrementProgramBufferIndex();
+  hash &= kIdentifierTableSize - 1;
 
-      break;
-    case ',':
-      token.type = kTokenComma;
+  while (0 != identifier_table[hash]) {
+    id = identifier_table[hash] - 1;
 
-      break;
-    case '.':
-      token.type = kTokenDot;
+    if (0 == strncmp(&identifier_pool[identifier_offsets[id]], text, length) &&
+        '\0' == identifier_pool[identifier_offsets[id] + length]) {
+      return id;
+    }
 
-      break;
-    case '$':
-      token.type = kTokenLeftBracket;
+    hash = (hash + 1) & (kIdentifierTableSize - 1);
+  }
 
-      break;
-    case '&':
-      token.type = kTokenRightBracket;
+  if (kIdentifiersSize <= identifier_count ||
+      kIdentifierPoolSize <= identifier_pool_index + length) {
+    ReportError("Error: Too many identifiers.\n");
 
-      break;
-    default:
-      return false;
+    return (size_t)-1;
   }
 
-  IncrementProgramBufferIndex();
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memcpy(&identifier_pool[identifier_pool_index], text, length);
+  identifier_pool[identifier_pool_index + length] = '\0';
+  identifier_offsets[identifier_count] = identifier_pool_index;
+  identifier_pool_index += length + 1;
+  identifier_table[hash] = identifier_count + 1;
 
-  return true;
+  return identifier_count++;
 }
 
-static bool IsKeyword(const char* const buffer) {
-  size_t keyword_index = 0;
+static const char* LexWord(const char* character) {
+  const char* const kStart = character;
+  size_t hash = 0;
+  size_t id = 0;
 
-  for (keyword_index = 0; keyword_index < kKeywordCount; ++keyword_index) {
-    const size_t kKeywordTextLength = strlen(kKeywordMap[keyword_index].kText);
+  do {
+    hash = (hash << 5) + hash + (unsigned char)*character;
+    ++character;
+  } while (kClassLetter == kCharacterClass[(unsigned char)*character] ||
+           kClassDigit == kCharacterClass[(unsigned char)*character]);
 
-    if (0 ==
-        strncmp(buffer, kKeywordMap[keyword_index].kText, kKeywordTextLength)) {
-      token.type = kKeywordMap[keyword_index].kType;
-
-      return true;
-    }
+  if (IsKeyword(kStart, (size_t)(character - kStart))) {
+    return character;
   }
 
-  return false;
-}
+  id = InternIdentifier(kStart, (size_t)(character - kStart), hash);
 
-static bool IsBoolean(const char* const buffer) {
-  if (0 == strncmp(buffer, "true", 4)) {
-    token.type = kTokenBoolean;
-    token.value.number = 1;
+  if ((size_t)-1 == id) {
+    token.type = kTokenEof;
 
-    return true;
+    return character;
   }
 
-  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
-  if (0 == strncmp(buffer, "false", 5)) {
-    token.type = kTokenBoolean;
-    token.value.number = 0;
+  token.type = kTokenIdentifier;
+  token.number = (int)id;
+
+  return character;
+}
 
-    return true;
+const char* TokenText(const Token* const text_token) {
+  if (kTokenIdentifier == text_token->type) {
+    return &identifier_pool[identifier_offsets[text_token->number]];
   }
 
-  return false;
+  return &program_source[text_token->start - program_source_base];
 }
 
-static bool IsNumber() {
-#ifdef __CC65__
-  char* end = NULL;
-  static const int kBase = 10;
-#else
-  char* end = nullptr;
-  static constexpr int kBase = 10;
-#endif
+void ConsumeNextToken() {
+  register const char* character = program_source;
+  unsigned char character_class = kClassNone;
 
-  size_t number_length = 0;
+#if defined(__CC65__) && !defined(NDEBUG)
+  StartSection(kSectionLex);
+#endif
 
-  if (!isdigit(program_buffer[program_buffer_index])) {
-    return false;
+  if (source_window == program_source) {
+    FillSourceWindow();
   }
 
-  token.type = kTokenNumber;
-  token.value.number =
-      (int)strtol(&program_buffer[program_buffer_index], &end, kBase);
+  // The source always ends in '\0', which no loop below scans past, so the
+  // index is only checked once per token.
+  if (program_source_size <= program_buffer_index - program_source_base) {
+    ReportError("Error: Program buffer overflow.\n");
 
-  number_length = end - &program_buffer[program_buffer_index];
-  program_buffer_index += number_length;
+    token.type = kTokenEof;
 
-  return true;
-}
+#if defined(__CC65__) && !defined(NDEBUG)
+    StopSection(kSectionLex);
+#endif
 
-void ExtractIdentifierName(char* const buffer) {
-  size_t token_value_text_length = strlen(token.value.text);
+    return;
+  }
 
-  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  strncpy(buffer, token.value.text, token_value_text_length);
+  character = &program_source[program_buffer_index - program_source_base];
 
-  buffer[token_value_text_length] = '\0';
-}
+  while (kClassSpace == kCharacterClass[(unsigned char)*character]) {
+    ++character;
 
-void ConsumeNextToken() {
-  SkipWhitespace();
+    // Whitespace may leave too little of the window of a streamed source for
+    // the token behind it.
+    if (!is_source_end &&
+        kClassSpace != kCharacterClass[(unsigned char)*character]) {
+      program_buffer_index =
+          program_source_base + (size_t)(character - program_source);
 
-  if ('\0' == program_buffer[program_buffer_index]) {
-    token.type = kTokenEof;
+      FillSourceWindow();
 
-    return;
+      character = &program_source[program_buffer_index - program_source_base];
+    }
   }
 
-  if ((int)IsCharacter() || (int)IsString()) {
-    return;
-  }
+  token.start = program_source_base + (size_t)(character - program_source);
 
-  if (isalpha(program_buffer[program_buffer_index])) {
-    int length = 0;
-    char buffer[kTokenTextBufferSize];
+  character_class = kCharacterClass[(unsigned char)*character];
 
-    while (isalnum(program_buffer[program_buffer_index])) {
-      if (length < (int)sizeof(buffer) - 1) {
-        buffer[length++] = program_buffer[program_buffer_index];
+  switch (character_class) {
+    case kClassNone:
+      if ('\0' != *character) {
+        ReportError("Error: Unregistered token '%c'.\n", *character);
       }
 
-      IncrementProgramBufferIndex();
-    }
+      token.type = kTokenEof;
 
-    buffer[length] = '\0';
+      break;
+    case kClassDigit:
+      character = LexNumber(character);
 
-    if ((int)IsBoolean(buffer) || (int)IsKeyword(buffer)) {
-      return;
-    }
+      break;
+    case kClassLetter:
+      character = LexWord(character);
 
-    token.type = kTokenIdentifier;
+      break;
+    case kClassQuote:
+      character = LexString(character);
 
-    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-    strncpy(token.value.text, buffer, strlen(buffer) + 1);
+      break;
+    default:
+      token.type = (TokenType)character_class;
+      ++character;
+
+      // Each of these is directly followed by its '=' variant in TokenType.
+      if ('=' == *character &&
+          (kTokenAssign == token.type || kTokenNot == token.type ||
+           kTokenLessThan == token.type || kTokenGreaterThan == token.type)) {
+        token.type = (TokenType)(character_class + 1);
+        ++character;
+      }
 
-    return;
+      break;
   }
 
-  if (IsNumber()) {
-    return;
+  program_buffer_index =
+      program_source_base + (size_t)(character - program_source);
+
+  if (kTokenString != token.type) {
+    token.length = program_buffer_index - token.start;
   }
 
-  printf("Error: Unregistered token '%c'.\n",
-         program_buffer[program_buffer_index]);
+  if ('\0' == *character && !is_source_end) {
+    ReportError("Error: Token too long.\n");
 
-  token.type = kTokenEof;
+    token.type = kTokenEof;
+  }
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StopSection(kSectionLex);
+#endif
 }
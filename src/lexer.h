@@ -17,11 +17,17 @@
 
 /// Checks if the current token is one of the argument tokens, and, if true,
 /// consumes the token and returns true.
-/// If false, an error is emitted.
-#define ExpectToken(token_type_list_length, ...)    \
-  (AcceptToken(token_type_list_length, __VA_ARGS__) \
-       ? true                                       \
-       : (puts("Error: Unexpected token."), false))
+/// If false, an error is emitted, unless an earlier error ended the source.
+#define ExpectToken(token_type_list_length, ...)                       \
+  (AcceptToken(token_type_list_length, __VA_ARGS__) ? true             \
+   : is_compile_error && kTokenEof == token.type                       \
+       ? false                                                         \
+       : (ReportError("Error: Unexpected token.\n"), false))
+
+/// Prints a compile error like printf, unless errors are silenced, and marks
+/// the compilation as failed.
+#define ReportError(...) \
+  (is_compile_error = true, is_error_silenced ? 0 : printf(__VA_ARGS__))
 
 #ifdef __clang__
 // NOLINTNEXTLINE(bugprone-reserved-identifier)
@@ -29,10 +35,10 @@
 #endif
 
 #ifdef __CC65__
-enum { kTokenTextBufferSize = 100, kProgramBufferSize = 8192 };
+enum { kProgramBufferSize = 8192, kIdentifiersSize = 128 };
 #else
-static constexpr int kTokenTextBufferSize = 100;
 static constexpr int kProgramBufferSize = 8192;
+static constexpr int kIdentifiersSize = 1024;
 #endif
 
 typedef enum TokenType {
@@ -81,25 +87,58 @@ typedef enum TokenType {
   kTokenArray
 } TokenType;
 
+/// A token refers to its text in program_source instead of holding a copy.
 typedef struct Token {
   TokenType type;
-  union value {
-    int number;
-    char text[kTokenTextBufferSize];
-  } value;
+  /// Position of the text in the source. The text of a string token starts
+  /// behind its opening quote.
+  size_t start;
+  size_t length;
+  /// Value of number and boolean tokens. Identifier tokens hold the id their
+  /// name is interned as, which is below kIdentifiersSize and the same for
+  /// every occurrence of the name.
+  int number;
 } Token;
 
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
 extern Token token;
 extern char program_buffer[];
+/// The source the lexer scans, terminated by '\0'. It is program_buffer unless
+/// SetProgramSource gives the lexer other text, such as a mapped file.
+/// program_buffer_index is the position in it.
+extern const char* program_source;
 extern size_t program_buffer_index;
+/// Set by ReportError. ParseProgram and ParseFragment clear it first.
+extern bool is_compile_error;
+/// Keeps ReportError quiet while the source is only scanned ahead, so that
+/// its errors are printed once, by the compilation.
+extern bool is_error_silenced;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 bool __cdecl__ AcceptTokenImplementation(size_t token_type_list_length, ...);
 
+/// Also makes the lexer scan program_buffer again.
 void ResetLexerState();
 
-void ExtractIdentifierName(char* buffer);
+/// Makes the lexer scan `size` bytes at `source` from the start. The last of
+/// them must be '\0'.
+void SetProgramSource(const char* source, size_t size);
+
+/// Reads up to `size` characters of the source from `position` on into
+/// `buffer`. Returns how many it read, fewer than `size` at the end.
+typedef size_t (*SourceReader)(size_t position, char* buffer, size_t size);
+
+/// Makes the lexer pull the source from the start through a small window that
+/// `reader` refills, so the source is never in memory as a whole. Positions
+/// such as program_buffer_index stay positions in the whole source.
+void SetProgramReader(SourceReader reader);
+
+/// Forgets all interned identifiers, so ids are handed out from zero again.
+void ResetIdentifiers();
+
+/// Returns the text of a token. It is not terminated, see Token::length.
+/// Identifiers return their interned name, which outlives the source text.
+const char* TokenText(const Token* text_token);
 
 /// Parse tokens.
 void ConsumeNextToken();
@@ -1,3 +1,8 @@
+#ifndef __CC65__
+// Exposes mmap's MAP_ANONYMOUS, which POSIX.1-2008 lacks.
+#define _DEFAULT_SOURCE
+#endif
+
 #ifdef __CC65__
 #include <stdbool.h>
 #endif
@@ -5,14 +10,34 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __CC65__
+#include <cbm.h>
+
+#include "benchmark.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "lexer.h"
 #include "parser.h"
 #include "vm.h"
 
 #ifdef __CC65__
-enum { kClearScreen = 147, kLineBufferSize = 81 };
+enum {
+  kClearScreen = 147,
+  kLineBufferSize = 81,
+  kFileNameSize = 85,
+  kTimePrefixLength = 5,
+  kSourceFile = 3,
+  kSourceDevice = 8
+};
 #else
 static constexpr int kLineBufferSize = 81;
+static constexpr int kFileNameSize = 85;
+static constexpr int kTimePrefixLength = 5;
 #endif
 
 typedef enum ExecutionMode { kModeDirect, kModeProgram } ExecutionMode;
@@ -21,22 +46,63 @@ typedef enum ExecutionMode { kModeDirect, kModeProgram } ExecutionMode;
 static ExecutionMode current_mode = kModeDirect;
 static char line_buffer[kLineBufferSize];
 static size_t line_buffer_length = 0;
+static bool is_register_vm = false;
+
+/// Program mode compiles each top-level statement once its last line is
+/// entered. The source in front of compiled_source_end is compiled.
+static size_t compiled_source_end = 0;
+/// Blocks the lines behind compiled_source_end open and don't close yet.
+static int open_blocks = 0;
+/// Cleared when a statement could not be compiled on its own, so that `run`
+/// compiles the whole program again.
+static bool is_program_compiled = true;
+
+/// Set by the `time` prefix until the statement or program it times has run.
+static bool is_timed = false;
+
+/// File name of a bytecode image or script, with the prefix, suffix or
+/// extension the platform needs.
+static char file_name[kFileNameSize];
+
+/// Position in the script `exec` reads, which the C128 reads sequentially.
+static size_t source_file_position = 0;
+#ifndef __CC65__
+static FILE* source_file = nullptr;
+#endif
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 static void PrintHelp() {
   puts("Usage:");
   puts("help  Show this message.");
   puts("ops   Print opcodes currently in buffer.");
+  puts("prof  Print and reset the opcode profile.");
+  puts("vm    Toggle stack and register VM.");
+  puts("      Direct mode always uses the stack VM.");
   puts("clear Clear the program buffer.");
+  puts("save  Save the compiled program to a file.");
+  puts("load  Load a saved program.");
+  puts("exec  Compile and run a script file.");
+  puts("time  Time compiling and running what follows.");
   puts("exit  Exit the interpreter.");
   puts("Direct mode:");
   puts("prog  Enter program mode.");
   puts("Program mode:");
   puts("run   Run entire program.");
+  puts("      'time run' compiles it all again.");
   puts("cont  Run program.");
   puts("dir   Return to direct mode.");
 }
 
+/// Reports what `time` measured and ends the measurement.
+static void PrintTiming(const unsigned long compile_ticks,
+                        const unsigned long run_ticks, const size_t size) {
+  printf("Compile: %lu ticks\n", compile_ticks);
+  printf("Run: %lu ticks\n", run_ticks);
+  printf("Bytecode: %u bytes\n", (unsigned int)size);
+
+  is_timed = false;
+}
+
 static void PrintMode(const char* const mode) {
   puts("");
   printf("%s mode.\n", mode);
@@ -48,38 +114,240 @@ static void CompileProgram() {
   ResetInterpreterState();
   ParseProgram();
   EmitHalt();
+
+  if (is_register_vm && !GenerateRegisterCode()) {
+    puts("Running on the stack VM.");
+  }
 }
 
-static void DirectMode() {
+static void ResetProgram() {
   ResetLexerState();
+  ResetParserState();
+  ResetInterpreterState();
+
+  compiled_source_end = 0;
+  open_blocks = 0;
+  is_program_compiled = true;
+  is_timed = false;
+}
+
+/// Returns how many more blocks the source from program_buffer_index on opens
+/// than it closes. Lexer errors are left for the parser to report.
+static int CountOpenedBlocks() {
+  const bool kIsCompileError = is_compile_error;
+  int count = 0;
+
+  is_error_silenced = true;
+
+  for (ConsumeNextToken(); kTokenEof != token.type; ConsumeNextToken()) {
+    switch (token.type) {
+      case kTokenIf:
+      case kTokenFor:
+      case kTokenWhile:
+      case kTokenFunc:
+        ++count;
+
+        break;
+      case kTokenEndif:
+      case kTokenEndfor:
+      case kTokenEndwhile:
+      case kTokenEndfunc:
+        --count;
+
+        break;
+      default:
+        break;
+    }
+  }
+
+  is_error_silenced = false;
+  is_compile_error = kIsCompileError;
+
+  return count;
+}
+
+/// Compiles the statements the entered line completes and appends their code
+/// to the program, so `run` doesn't need to compile it again.
+static void CompileLine(const size_t line_start) {
+  const size_t kSourceEnd = program_buffer_index;
+
+  program_buffer_index = line_start;
+  open_blocks += CountOpenedBlocks();
+
+  // A stray end of a block is an error, which the parser reports.
+  if (0 > open_blocks) {
+    open_blocks = 0;
+  }
+
+  if (0 == open_blocks && is_program_compiled) {
+    RemoveHalt();
+
+    program_buffer_index = compiled_source_end;
+    is_program_compiled = ParseFragment();
+    compiled_source_end = kSourceEnd;
+
+    EmitHalt();
+
+    // The register code is generated again by `run`.
+    register_instruction_address = 0;
+  }
+
+  program_buffer_index = kSourceEnd;
+}
+
+/// Compiles the whole program again unless the compiled lines cover it.
+static void PrepareProgram() {
+  if (0 != open_blocks || !is_program_compiled) {
+    CompileProgram();
+
+    // Statements still lacking lines are compiled once they are complete.
+    compiled_source_end = program_buffer_index;
+    is_program_compiled = 0 == open_blocks;
+  } else if (is_register_vm && !GenerateRegisterCode()) {
+    puts("Running on the stack VM.");
+  }
+}
+
+static void RunProgram() {
+#if defined(__CC65__) && !defined(NDEBUG)
+  StartSection(kSectionRun);
+#endif
+
+  if (is_register_vm && 0 != register_instruction_address) {
+    RunRegisterVm();
+  } else {
+    RunVm();
+  }
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StopSection(kSectionRun);
+#endif
+}
+
+#if defined(__CC65__) && !defined(NDEBUG)
+/// Prints the ticks of the sections measured since the last call. Printing
+/// waits until the measurement is over, so it doesn't add to the ticks.
+static void PrintSections() {
+  static const char* const kSectionNames[kSectionCount] = {"Lex", "Parse",
+                                                           "Run", "Print"};
+
+  unsigned char section = 0;
+
+  for (section = 0; section < kSectionCount; ++section) {
+    if (0 != GetSectionTicks(section)) {
+      printf("%s: %lu ticks\n", kSectionNames[section],
+             GetSectionTicks(section));
+    }
+  }
+
+  ClearSections();
+}
+#endif
+
+/// Direct mode is a session: symbols, globals, functions and constants
+/// persist from line to line. Each statement appends its code and runs only
+/// that, once the line completing it is entered.
+static void DirectMode() {
+  // Compiled code keeps no reference to its source, so the source starts
+  // over unless it holds the first lines of an unfinished block.
+  const size_t kLineStart = program_buffer_index;
+  size_t code_start = 0;
+  bool is_compiled = false;
+  unsigned long compile_ticks = 0;
+  unsigned long run_ticks = 0;
 
   line_buffer_length = strlen(line_buffer);
 
+  if (kProgramBufferSize <= kLineStart + line_buffer_length + 1) {
+    puts("Error: Program buffer overflow.");
+
+    program_buffer_index = 0;
+    open_blocks = 0;
+    is_timed = false;
+
+    return;
+  }
+
   // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  strncpy(&program_buffer[program_buffer_index], line_buffer,
-          line_buffer_length);
-  program_buffer[line_buffer_length] = '\0';
+  strncpy(&program_buffer[kLineStart], line_buffer, line_buffer_length);
+  program_buffer[kLineStart + line_buffer_length] = '\0';
 
-  CompileProgram();
-  RunVm();
+  program_buffer_index = kLineStart;
+  open_blocks += CountOpenedBlocks();
+
+  if (0 < open_blocks) {
+    program_buffer_index = kLineStart + line_buffer_length;
+
+    return;
+  }
+
+  open_blocks = 0;
+  program_buffer_index = 0;
+
+  RemoveHalt();
+
+  code_start = instruction_address;
+  compile_ticks = ReadTicks();
+  is_compiled = ParseFragment();
+
+  EmitHalt();
+
+  compile_ticks = ReadTicks() - compile_ticks;
+  program_buffer_index = 0;
+
+  // The register code covers whole programs, so lines run on the stack VM.
+  if (is_compiled) {
+#if defined(__CC65__) && !defined(NDEBUG)
+    StartSection(kSectionRun);
+#endif
+
+    run_ticks = ReadTicks();
+    RunVmFrom(code_start);
+    run_ticks = ReadTicks() - run_ticks;
+
+#if defined(__CC65__) && !defined(NDEBUG)
+    StopSection(kSectionRun);
+#endif
+  }
+
+  if (is_timed) {
+    PrintTiming(compile_ticks, run_ticks, instruction_address - code_start);
+  }
 }
 
 static void ProgramMode() {
   if (0 == strncmp("cont", line_buffer, 4)) {
-    RunVm();
+    RunProgram();
 
     return;
   }
 
   if (0 == strncmp("run", line_buffer, 3)) {
-    CompileProgram();
-    RunVm();
+    unsigned long compile_ticks = 0;
+    unsigned long run_ticks = 0;
+
+    // Lines are compiled as they are entered, so only compiling all of them
+    // again shows what the program costs to compile.
+    if (is_timed) {
+      is_program_compiled = false;
+    }
+
+    compile_ticks = ReadTicks();
+    PrepareProgram();
+    compile_ticks = ReadTicks() - compile_ticks;
+
+    run_ticks = ReadTicks();
+    RunProgram();
+    run_ticks = ReadTicks() - run_ticks;
+
+    if (is_timed) {
+      PrintTiming(compile_ticks, run_ticks,
+                  instruction_address + register_instruction_address);
+    }
 
     return;
   }
 
-  RemoveHalt();
-
   line_buffer_length = strlen(line_buffer);
 
   if (kProgramBufferSize <= program_buffer_index + line_buffer_length + 1) {
@@ -95,11 +363,283 @@ static void ProgramMode() {
   program_buffer_index += line_buffer_length;
 
   program_buffer[program_buffer_index] = '\0';
+
+  CompileLine(program_buffer_index - line_buffer_length);
 }
 
-int main() {
+/// Sets file_name to the file name following the `save`, `load` or `exec`
+/// command. The C128 replaces an existing file on save and reads scripts from
+/// sequential files. Natively images get the .ybc extension unless they have
+/// it already. Returns false if there is no name.
+static bool ParseFileName(const bool is_image, const bool is_save) {
+  char* name = &line_buffer[4];
+  size_t length = 0;
+
+  while (' ' == *name) {
+    ++name;
+  }
+
+  length = strcspn(name, "\r\n");
+  name[length] = '\0';
+
+  if (0 == length) {
+    puts("Error: File name missing.");
+
+    return false;
+  }
+
 #ifdef __CC65__
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.sprintf)
+  sprintf(file_name, is_save ? "@0:%s" : (is_image ? "%s" : "%s,s"), name);
+#else
+  (void)is_save;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+  snprintf(file_name, kFileNameSize,
+           is_image && (4 > length || 0 != strcmp(".ybc", &name[length - 4]))
+               ? "%s.ybc"
+               : "%s",
+           name);
+#endif
+
+  return true;
+}
+
+static void SaveProgram() {
+  if (!ParseFileName(true, true)) {
+    return;
+  }
+
+  // The compiler reports why a program fails, a partial one isn't saved.
+  // Direct mode drops lines that fail, so its code is always complete.
+  if (kModeProgram == current_mode) {
+    PrepareProgram();
+
+    if (is_compile_error) {
+      return;
+    }
+  }
+
+  if (SaveImage(file_name)) {
+    puts("Saved.");
+  }
+}
+
+/// Replaces the program by a saved one, which direct mode runs right away and
+/// program mode on `run`. Its source is not part of the image.
+static void LoadProgram() {
+  if (!ParseFileName(true, false)) {
+    return;
+  }
+
+  ResetProgram();
+
+  if (!LoadImage(file_name)) {
+    return;
+  }
+
+  puts("Loaded.");
+
+  if (kModeDirect == current_mode) {
+    RunVm();
+  }
+}
+
+/// Reads the script `exec` opened for the lexer. The KERNAL reads files
+/// sequentially, so moving back opens the file again.
+static size_t ReadSourceFile(const size_t position, char* const buffer,
+                             const size_t size) {
+#ifdef __CC65__
+  int read = 0;
+
+  if (position < source_file_position) {
+    cbm_close(kSourceFile);
+    cbm_open(kSourceFile, kSourceDevice, CBM_READ, file_name);
+
+    source_file_position = 0;
+  }
+
+  while (source_file_position < position) {
+    read = cbm_read(kSourceFile, buffer,
+                    size < position - source_file_position
+                        ? size
+                        : position - source_file_position);
+
+    if (0 >= read) {
+      return 0;
+    }
+
+    source_file_position += (size_t)read;
+  }
+
+  read = cbm_read(kSourceFile, buffer, size);
+
+  if (0 > read) {
+    return 0;
+  }
+
+  source_file_position += (size_t)read;
+
+  return (size_t)read;
+#else
+  if (position != source_file_position &&
+      0 != fseek(source_file, (long)position, SEEK_SET)) {
+    return 0;
+  }
+
+  source_file_position = position + fread(buffer, 1, size, source_file);
+
+  return source_file_position - position;
+#endif
+}
+
+/// Compiles a script file and runs it. Only a small window of its text is in
+/// memory at a time, so it may be far larger than the program buffer.
+static void ExecuteScript() {
+  if (!ParseFileName(false, false)) {
+    return;
+  }
+
+#ifdef __CC65__
+  if (0 != cbm_open(kSourceFile, kSourceDevice, CBM_READ, file_name)) {
+#else
+  source_file = fopen(file_name, "rb");
+
+  if (nullptr == source_file) {
+#endif
+    puts("Error: Cannot open script.");
+
+    return;
+  }
+
+  ResetProgram();
+
+  source_file_position = 0;
+
+  SetProgramReader(ReadSourceFile);
+  CompileProgram();
+
+#ifdef __CC65__
+  cbm_close(kSourceFile);
+#else
+  fclose(source_file);
+#endif
+
+  // Keeps the interned identifiers, which the symbols of the script use.
+  SetProgramSource(program_buffer, kProgramBufferSize);
+
+  if (!is_compile_error) {
+    RunProgram();
+  }
+}
+
+#ifndef __CC65__
+/// Compiles the script at `path` straight from a read-only mapping of the
+/// file, so it is neither copied nor limited to the size of program_buffer.
+/// Returns false if the file can't be mapped or doesn't compile.
+static bool CompileScript(const char* const path) {
+  const int kFile = open(path, O_RDONLY);
+  const size_t kPageSize = (size_t)sysconf(_SC_PAGESIZE);
+  struct stat file_status;
+  size_t file_size = 0;
+  size_t mapping_size = 0;
+  void* mapping = MAP_FAILED;
+
+  if (-1 == kFile || 0 != fstat(kFile, &file_status)) {
+    puts("Error: Cannot open script.");
+
+    if (-1 != kFile) {
+      close(kFile);
+    }
+
+    return false;
+  }
+
+  // The file is mapped over zeroed pages that reach at least one byte past
+  // its end, which terminates the source even if it fills its last page.
+  file_size = (size_t)file_status.st_size;
+  mapping_size = (file_size / kPageSize + 1) * kPageSize;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+
+  if (MAP_FAILED != mapping && 0 != file_size &&
+      MAP_FAILED == mmap(mapping, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                         kFile, 0)) {
+    munmap(mapping, mapping_size);
+
+    mapping = MAP_FAILED;
+  }
+
+  close(kFile);
+
+  if (MAP_FAILED == mapping) {
+    puts("Error: Cannot map script.");
+
+    return false;
+  }
+
+  SetProgramSource((const char*)mapping, file_size + 1);
+  CompileProgram();
+
+  // The compiled program keeps no reference to its source.
+  munmap(mapping, mapping_size);
+  ResetLexerState();
+
+  return !is_compile_error;
+}
+
+/// `SCRIPT` compiles and runs a script file, `--compile SCRIPT IMAGE`
+/// compiles it to a bytecode image and `--load IMAGE` runs an image without
+/// compiling anything. Returns the exit status, or -1 to start the
+/// interpreter.
+static int RunCommandLine(const int argc, char* argv[]) {
+  if (1 == argc) {
+    return -1;
+  }
+
+  if (2 == argc && '-' != argv[1][0]) {
+    if (!CompileScript(argv[1])) {
+      return EXIT_FAILURE;
+    }
+
+    RunVm();
+
+    return EXIT_SUCCESS;
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+  if (4 == argc && 0 == strcmp("--compile", argv[1])) {
+    return CompileScript(argv[2]) && SaveImage(argv[3]) ? EXIT_SUCCESS
+                                                         : EXIT_FAILURE;
+  }
+
+  if (3 == argc && 0 == strcmp("--load", argv[1])) {
+    if (!LoadImage(argv[2])) {
+      return EXIT_FAILURE;
+    }
+
+    RunVm();
+
+    return EXIT_SUCCESS;
+  }
+
+  puts("Usage: yali-native [SCRIPT | --compile SCRIPT IMAGE | --load IMAGE]");
+
+  return EXIT_FAILURE;
+}
+#endif
+
+#ifdef __CC65__
+int main() {
   putchar(kClearScreen);
+  StartTimer();
+#else
+int main(const int argc, char* argv[]) {
+  const int kStatus = RunCommandLine(argc, argv);
+
+  if (-1 != kStatus) {
+    return kStatus;
+  }
 #endif
 
   puts("Welcome to the Yap Language!");
@@ -125,8 +665,7 @@ int main() {
 
     // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
     if (0 == strncmp(line_buffer, "clear", 5)) {
-      ResetLexerState();
-      ResetInterpreterState();
+      ResetProgram();
 
       puts("Cleared.");
 
@@ -139,15 +678,46 @@ int main() {
       continue;
     }
 
+    if (0 == strncmp("save ", line_buffer, 5)) {
+      SaveProgram();
+
+      continue;
+    }
+
+    if (0 == strncmp("load ", line_buffer, 5)) {
+      LoadProgram();
+
+      continue;
+    }
+
+    if (0 == strncmp("exec ", line_buffer, 5)) {
+      ExecuteScript();
+
+      continue;
+    }
+
     if (0 == strncmp("ops", line_buffer, 3)) {
       PrintOpcodes();
 
       continue;
     }
 
+    if (0 == strncmp("prof", line_buffer, 4)) {
+      PrintProfile();
+
+      continue;
+    }
+
+    if (0 == strncmp("vm", line_buffer, 2)) {
+      is_register_vm = !is_register_vm;
+
+      puts(is_register_vm ? "Register VM." : "Stack VM.");
+
+      continue;
+    }
+
     if (0 == strncmp("prog", line_buffer, 4) && kModeDirect == current_mode) {
-      ResetLexerState();
-      ResetInterpreterState();
+      ResetProgram();
 
       current_mode = kModeProgram;
 
@@ -157,8 +727,7 @@ int main() {
     }
 
     if (0 == strncmp("dir", line_buffer, 3) && kModeProgram == current_mode) {
-      ResetLexerState();
-      ResetInterpreterState();
+      ResetProgram();
 
       current_mode = kModeDirect;
 
@@ -167,15 +736,29 @@ int main() {
       continue;
     }
 
-    if (kModeDirect == current_mode) {
-      DirectMode();
+    if (0 == strncmp("time ", line_buffer, kTimePrefixLength)) {
+      if (kModeProgram == current_mode &&
+          0 != strncmp("run", &line_buffer[kTimePrefixLength], 3)) {
+        puts("Error: Program mode only times 'run'.");
 
-      continue;
+        continue;
+      }
+
+      memmove(line_buffer, &line_buffer[kTimePrefixLength],
+              strlen(&line_buffer[kTimePrefixLength]) + 1);
+
+      is_timed = true;
     }
 
-    if (kModeProgram == current_mode) {
+    if (kModeDirect == current_mode) {
+      DirectMode();
+    } else {
       ProgramMode();
     }
+
+#if defined(__CC65__) && !defined(NDEBUG)
+    PrintSections();
+#endif
   }
 
   puts("Bye!");
@@ -16,18 +16,62 @@
 #include "vm.h"
 
 #ifdef __CC65__
-enum { kIdentifierNameLength = 16, kSymbolTableSize = 16 };
+enum {
+  kLocalsSize = 16,
+  kPeepholeWindowSize = 4,
+  kVirtualStackSize = 16,
+  kRegisterPatchesSize = 64
+};
 #else
-static constexpr int kIdentifierNameLength = 16;
-static constexpr int kSymbolTableSize = 16;
+static constexpr int kLocalsSize = 16;
+static constexpr int kPeepholeWindowSize = 4;
+static constexpr int kVirtualStackSize = 16;
+static constexpr int kRegisterPatchesSize = 64;
 #endif
 
 typedef struct SymbolTableEntry {
-  char name[kIdentifierNameLength];
   VariableType type;
   size_t index;
+  /// Zero unless the symbol names a function, whose calls then jump straight
+  /// to this address.
+  size_t body_start_address;
+  size_t arity;
+  /// Row of the function in parameter_types.
+  size_t function_index;
 } SymbolTableEntry;
 
+/// Binding strength of the binary operators, from weakest to strongest.
+enum Precedence {
+  kPrecedenceNone,
+  kPrecedenceComparison,
+  kPrecedenceSum,
+  kPrecedenceProduct
+};
+
+/// Precedence of every token type up to the last binary operator.
+static const unsigned char kBinaryPrecedence[kTokenGreaterOrEquals + 1] = {
+    kPrecedenceNone,        // kTokenEof
+    kPrecedenceNone,        // kTokenIdentifier
+    kPrecedenceNone,        // kTokenNumber
+    kPrecedenceSum,         // kTokenPlus
+    kPrecedenceSum,         // kTokenMinus
+    kPrecedenceProduct,     // kTokenStar
+    kPrecedenceProduct,     // kTokenSlash
+    kPrecedenceProduct,     // kTokenPercent
+    kPrecedenceNone,        // kTokenDot
+    kPrecedenceNone,        // kTokenComma
+    kPrecedenceNone,        // kTokenColon
+    kPrecedenceNone,        // kTokenSemicolon
+    kPrecedenceNone,        // kTokenAssign
+    kPrecedenceComparison,  // kTokenEquals
+    kPrecedenceNone,        // kTokenNot
+    kPrecedenceComparison,  // kTokenNotEquals
+    kPrecedenceComparison,  // kTokenLessThan
+    kPrecedenceComparison,  // kTokenLessOrEquals
+    kPrecedenceComparison,  // kTokenGreaterThan
+    kPrecedenceComparison   // kTokenGreaterOrEquals
+};
+
 const char* VariableTypeToString(VariableType type) {
   switch (type) {
     case kVariableTypeInt:
@@ -43,34 +87,407 @@ const char* VariableTypeToString(VariableType type) {
   }
 }
 
-// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
-static SymbolTableEntry symbol_table[kSymbolTableSize];
+/// Returns whether an expression of type `type` failed with an error that was
+/// reported already, so a type error about it would only repeat that error.
+static bool IsReportedError(const VariableType type) {
+  return kVariableTypeUnknown == type && is_compile_error;
+}
 
-static char local_names[kSymbolTableSize][kIdentifierNameLength];
+// NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
+/// One entry per global variable of the VM, in the order they are defined.
+static SymbolTableEntry symbol_table[kGlobalVariablesSize];
+
+/// Symbol table index plus one by identifier id, or zero if the identifier
+/// names no global symbol. Resolving a name never compares strings, as the
+/// lexer interned it already.
+static size_t global_symbols[kIdentifiersSize];
+/// One past the highest identifier id global_symbols maps, so that clearing
+/// it doesn't walk ids that never named a global.
+static size_t global_symbols_end = 0;
+
+/// Parameter index plus one by identifier id, or zero if the identifier is
+/// no parameter of the function defined last.
+static size_t local_symbols[kIdentifiersSize];
+/// Identifier ids of the parameters, to clear local_symbols again.
+static size_t local_identifiers[kLocalsSize];
+/// Declared types of the parameters, by parameter index.
+static VariableType local_types[kLocalsSize];
 static size_t local_count = 0;
 
 static bool is_function_scope = false;
+
+/// Functions the compiled code defines, at most kFunctionPoolSize.
+static size_t function_count = 0;
+
+/// Declared parameter types of each function. Direct calls check their
+/// arguments against them, so a parameter always holds a value of its type.
+static unsigned char parameter_types[kFunctionPoolSize][kLocalsSize];
+
+/// Set while the statements of a function body are parsed, where `ret` may
+/// turn a call into a tail call.
+static bool is_function_body = false;
+/// Return type of the function whose body is parsed.
+static VariableType body_return_type = kVariableTypeUnknown;
+/// Whether the statement parsed last at the top of the function body was a
+/// `ret`, so the body can't fall through to its end.
+static bool is_body_returned = false;
+
+/// Start addresses of the most recently emitted instructions, oldest first.
+/// The window is cleared at every jump target, so a superinstruction never
+/// swallows an instruction that another path jumps into.
+static size_t peephole_window[kPeepholeWindowSize];
+static size_t peephole_count = 0;
+
+/// Set when a jump target or function body address does not fit the narrow
+/// bytecode format, so ParseProgram compiles the program again in the wide
+/// one.
+static bool is_address_overflow = false;
+
+/// Register operands standing in for the stack machine's operand stack while
+/// the register code generator replays the stack code. Constants, globals and
+/// locals are used in place; only intermediate results get a frame register.
+static unsigned char virtual_stack[kVirtualStackSize];
+static size_t virtual_stack_depth = 0;
+
+static bool is_jump_target[kInstructionsSize];
+static unsigned char register_addresses[kInstructionsSize];
+static size_t register_patch_slots[kRegisterPatchesSize];
+static unsigned char register_patch_targets[kRegisterPatchesSize];
+static size_t register_patch_count = 0;
+
+static bool is_register_function = false;
+static size_t frame_parameter_count = 0;
+static size_t frame_size = 0;
+static size_t frame_size_slot = 0;
+
+/// Address of the destination operand of the last register instruction, as
+/// long as its result is still on top of the virtual stack. Zero otherwise,
+/// which never is a destination since the code starts with kRegisterOpEnter.
+static size_t result_slot = 0;
+static bool is_register_code_valid = true;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 static void ParseStatement();
 
 static VariableType ParseExpression();
 
-static VariableType ParseArithmeticExpression();
-
-static void ParseIdentifierStatement(const char* identifier_name);
+static void ParseIdentifierStatement(const Token* identifier);
 
-static void ParseFunctionDefinition(const char* identifier_name,
+static void ParseFunctionDefinition(const Token* identifier,
                                     VariableType return_type);
 
+static void ClearLocalSymbols();
+
+/// Symbol table entries are written in full when they are added, so only the
+/// identifier maps need clearing. The global variables are counted by the VM,
+/// ResetInterpreterState clears them and sets global_variable_index to zero.
 void ResetParserState() {
-  // NOLINTBEGIN(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  memset(symbol_table, 0, kSymbolTableSize * sizeof(SymbolTableEntry));
-  memset(local_names, 0, kSymbolTableSize);
-  // NOLINTEND(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memset(global_symbols, 0, global_symbols_end * sizeof(size_t));
 
-  global_variable_index = 0;
-  local_count = 0;
+  global_symbols_end = 0;
+  peephole_count = 0;
+  function_count = 0;
+
+  ClearLocalSymbols();
+}
+
+static void EmitOpcode(const Opcode opcode) {
+  size_t index = 0;
+
+  // An instruction that doesn't fit fills the buffer instead, so that no
+  // operand, patch or superinstruction reaches past its end. The program is
+  // reported as too large then.
+  if (kInstructionsSize < instruction_address + 1 + kOperandCount[opcode]) {
+    instruction_address = kInstructionsSize;
+    peephole_count = 0;
+
+    return;
+  }
+
+  if (kPeepholeWindowSize == peephole_count) {
+    for (index = 1; index < kPeepholeWindowSize; ++index) {
+      peephole_window[index - 1] = peephole_window[index];
+    }
+
+    --peephole_count;
+  }
+
+  peephole_window[peephole_count++] = instruction_address;
+
+  EmitByte(opcode);
+}
+
+/// Returns the current address as a jump target and closes the peephole
+/// window in front of it.
+static size_t MarkJumpTarget() {
+  peephole_count = 0;
+
+  return instruction_address;
+}
+
+static void PatchJump(const size_t patch_slot) {
+  const size_t kTarget = MarkJumpTarget();
+
+  // The jump didn't fit, see EmitOpcode.
+  if (kInstructionsSize <= patch_slot) {
+    return;
+  }
+
+  if (kBytecodeFormatWide == bytecode_format) {
+    instructions[patch_slot] = (unsigned char)kTarget;
+    instructions[patch_slot + 1] = (unsigned char)(kTarget >> 8);
+
+    return;
+  }
+
+  if (kNarrowOperandMax < kTarget) {
+    is_address_overflow = true;
+  }
+
+  instructions[patch_slot] = (unsigned char)kTarget;
+}
+
+/// Returns the opcode of a recently emitted instruction, where age 0 is the
+/// newest one. The caller checks peephole_count first.
+static unsigned char RecentOpcode(const size_t age) {
+  return instructions[peephole_window[peephole_count - 1 - age]];
+}
+
+/// Collapses the last `count` instructions into one superinstruction and
+/// returns its address. The caller rewrites the operands and truncates the
+/// instruction buffer behind them.
+static size_t FuseInstructions(const size_t count, const Opcode opcode) {
+  const size_t kAddress = peephole_window[peephole_count - count];
+
+  peephole_count -= count - 1;
+  instructions[kAddress] = opcode;
+
+  return kAddress;
+}
+
+static void TruncateInstructions(const size_t end_address) {
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memset(&instructions[end_address], 0, instruction_address - end_address);
+
+  instruction_address = end_address;
+}
+
+/// kOpLoadGlobal x; kOpPushSmallInt n; kOpAdd -> kOpLoadGlobalAddConst x n
+static void FuseLoadGlobalAddConst() {
+  size_t address = 0;
+
+  if (peephole_count < 3 ||
+      (kOpAdd != RecentOpcode(0) && kOpAddInt != RecentOpcode(0)) ||
+      kOpPushSmallInt != RecentOpcode(1) ||
+      kOpLoadGlobal != RecentOpcode(2)) {
+    return;
+  }
+
+  address = FuseInstructions(3, kOpLoadGlobalAddConst);
+
+  // The global index stays in place, the immediate moves up.
+  instructions[address + 2] = instructions[address + 4];
+
+  TruncateInstructions(address + 3);
+}
+
+/// kOpLoadGlobalAddConst x n; kOpStoreGlobal x -> kOpIncGlobal x n
+static void FuseIncGlobal() {
+  size_t address = 0;
+
+  if (peephole_count < 2 || kOpStoreGlobal != RecentOpcode(0) ||
+      kOpLoadGlobalAddConst != RecentOpcode(1)) {
+    return;
+  }
+
+  address = peephole_window[peephole_count - 2];
+
+  if (instructions[address + 1] != instructions[address + 4]) {
+    return;
+  }
+
+  FuseInstructions(2, kOpIncGlobal);
+  TruncateInstructions(address + 3);
+}
+
+/// kOpLoadGlobal x; kOpPushSmallInt n; <comparison>; kOpJumpIfFalse target
+/// -> kOpCompareGlobalConstJump x n <comparison> target
+static void FuseCompareGlobalConstJump() {
+  size_t address = 0;
+  unsigned char comparison = 0;
+
+  if (peephole_count < 4 ||
+      (kOpJumpIfFalse != RecentOpcode(0) &&
+       kOpJumpIfFalseBool != RecentOpcode(0)) ||
+      kOpPushSmallInt != RecentOpcode(2) ||
+      kOpLoadGlobal != RecentOpcode(3)) {
+    return;
+  }
+
+  comparison = RecentOpcode(1);
+
+  if (kOpEqualsInt <= comparison && kOpLessThanOrEqualToInt >= comparison) {
+    comparison = comparison - kOpEqualsInt + kOpEquals;
+  }
+
+  if (kOpEquals > comparison || kOpLessThanOrEqualTo < comparison) {
+    return;
+  }
+
+  address = FuseInstructions(4, kOpCompareGlobalConstJump);
+
+  instructions[address + 2] = instructions[address + 4];
+  instructions[address + 3] = comparison;
+  instructions[address + 4] = 0;
+
+  TruncateInstructions(address + 5);
+}
+
+/// Emits an instruction with a constant or global index operand, using the
+/// wide variant of the opcode if the index needs two bytes.
+static void EmitIndexedOpcode(const Opcode opcode, const Opcode wide_opcode,
+                              const size_t index) {
+  if (kNarrowOperandMax < index) {
+    EmitOpcode(wide_opcode);
+    EmitByte((unsigned char)index);
+    EmitByte((unsigned char)(index >> 8));
+
+    return;
+  }
+
+  EmitOpcode(opcode);
+  EmitByte((unsigned char)index);
+}
+
+/// Pushes the constant at `index`. Returns false and ends the parse if the
+/// constant pool had no room for it.
+static bool EmitConstant(const size_t index) {
+  if ((size_t)-1 == index) {
+    ReportError("Error: Too many constants.\n");
+    token.type = kTokenEof;
+
+    return false;
+  }
+
+  EmitIndexedOpcode(kOpConstant, kOpConstantWide, index);
+
+  return true;
+}
+
+/// Pushes an integer or boolean literal. Booleans and integers that fit in
+/// two bytes are encoded in the instruction itself, only wider integers go to
+/// the constant pool.
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static bool EmitLiteral(const int value, const ConstantType constant_type) {
+  if (kConstantTypeBoolean == constant_type) {
+    EmitOpcode(0 != value ? kOpPushTrue : kOpPushFalse);
+
+    return true;
+  }
+
+  if (0 <= value && kNarrowOperandMax >= value) {
+    EmitOpcode(kOpPushSmallInt);
+    EmitByte((unsigned char)value);
+
+    return true;
+  }
+
+  if ((short)value == value) {
+    EmitOpcode(kOpPushInt16);
+    EmitByte((unsigned char)value);
+    EmitByte((unsigned char)((unsigned)value >> 8));
+
+    return true;
+  }
+
+  return EmitConstant(AddNumberConstant(value, constant_type));
+}
+
+/// Decodes the integer or boolean literal pushed by the instruction at
+/// `address`. Returns false if it pushes anything else.
+static bool ReadLiteral(const size_t address, int* const value,
+                        ConstantType* const constant_type) {
+  const size_t kIndex = instructions[address + 1];
+
+  *constant_type = kConstantTypeNumber;
+
+  switch (instructions[address]) {
+    case kOpPushSmallInt:
+      *value = (int)instructions[address + 1];
+
+      return true;
+    case kOpPushInt16:
+      *value = (short)(kIndex | (size_t)instructions[address + 2] << 8);
+
+      return true;
+    case kOpPushTrue:
+    case kOpPushFalse:
+      *value = kOpPushTrue == instructions[address];
+      *constant_type = kConstantTypeBoolean;
+
+      return true;
+    case kOpConstant:
+      *constant_type = GetConstantType(kIndex);
+      *value = GetNumberConstant(kIndex);
+
+      return kConstantTypeString != *constant_type;
+    default:
+      return false;
+  }
+}
+
+/// Removes the literal pushed at `address`, and everything after it, again.
+static void RemoveLiteral(const size_t address) {
+  if (kOpConstant == instructions[address]) {
+    DiscardNumberConstant(instructions[address + 1]);
+  }
+
+  TruncateInstructions(address);
+}
+
+/// Emits a jump target or function body address in the current bytecode
+/// format and returns the address of the operand.
+static size_t EmitAddress(const size_t address) {
+  const size_t kSlot = instruction_address;
+
+  EmitByte((unsigned char)address);
+
+  if (kBytecodeFormatWide == bytecode_format) {
+    EmitByte((unsigned char)(address >> 8));
+  } else if (kNarrowOperandMax < address) {
+    is_address_overflow = true;
+  }
+
+  return kSlot;
+}
+
+/// Emits an unconditional jump and returns the address of its target operand,
+/// which PatchJump fills in for forward jumps.
+static size_t EmitJump(const size_t target) {
+  EmitOpcode(kBytecodeFormatWide == bytecode_format ? kOpJumpWide : kOpJump);
+
+  return EmitAddress(target);
+}
+
+/// Emits a conditional jump with a placeholder target and returns the address
+/// of the target operand to patch. A condition that is proven to be a boolean
+/// skips the run time tag check.
+static size_t EmitJumpIfFalse(const VariableType condition_type) {
+  const bool kIsBoolean = kVariableTypeBool == condition_type;
+
+  if (kBytecodeFormatWide == bytecode_format) {
+    EmitOpcode(kIsBoolean ? kOpJumpIfFalseBoolWide : kOpJumpIfFalseWide);
+
+    return EmitAddress(0);
+  }
+
+  EmitOpcode(kIsBoolean ? kOpJumpIfFalseBool : kOpJumpIfFalse);
+  EmitByte(0);
+
+  FuseCompareGlobalConstJump();
+
+  return instruction_address - 1;
 }
 
 static VariableType TokenTypeToVariableType(const TokenType token_type) {
@@ -86,139 +503,262 @@ static VariableType TokenTypeToVariableType(const TokenType token_type) {
     case kTokenArray:
       return kVariableTypeArray;
     default:
-      puts("Error: Unknown variable type.");
+      ReportError("Error: Unknown variable type.\n");
       return kVariableTypeUnknown;
   }
 }
 
-static size_t FindGlobalSymbol(const char* const identifier_name) {
-  size_t index = 0;
-
-  for (index = 0; index <= global_variable_index; ++index) {
-    if (0 == strcmp(symbol_table[index].name, identifier_name)) {
-      return index;
-    }
-  }
+// Both return (size_t)-1 for a missing symbol, as the maps hold zero then.
+static size_t FindGlobalSymbol(const Token* const identifier) {
+  return global_symbols[identifier->number] - 1;
+}
 
-  return (size_t)-1;
+static size_t FindLocalSymbol(const Token* const identifier) {
+  return local_symbols[identifier->number] - 1;
 }
 
-static size_t FindLocalSymbol(const char* const identifier_name) {
+/// Makes the parameters of the function defined last unknown again.
+static void ClearLocalSymbols() {
   size_t index = 0;
 
   for (index = 0; index < local_count; ++index) {
-    if (0 == strcmp(local_names[index], identifier_name)) {
-      return index;
-    }
+    local_symbols[local_identifiers[index]] = 0;
   }
 
-  return (size_t)-1;
+  local_count = 0;
 }
 
-static size_t AddSymbol(const char* const identifier_name,
+static size_t AddSymbol(const Token* const identifier,
                         const VariableType var_type) {
-  if (kIdentifierNameLength < strlen(identifier_name)) {
-    puts("Error: Symbol name is too long.");
+  if (global_variable_index >= kGlobalVariablesSize) {
+    ReportError("Error: Too many global variables.\n");
 
     return (size_t)-1;
   }
 
-  if (global_variable_index >= kSymbolTableSize) {
-    puts("Error: Too many global variables.");
+  if ((size_t)-1 != FindGlobalSymbol(identifier)) {
+    ReportError("Error: Already defined symbol '%.*s'.\n",
+                (int)identifier->length, TokenText(identifier));
 
     return (size_t)-1;
   }
 
-  if ((size_t)-1 != FindGlobalSymbol(identifier_name)) {
-    printf("Error: Already defined symbol '%s'.\n", identifier_name);
+  global_symbols[identifier->number] = global_variable_index + 1;
 
-    return (size_t)-1;
+  if (global_symbols_end <= (size_t)identifier->number) {
+    global_symbols_end = (size_t)identifier->number + 1;
   }
 
-  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  strncpy(symbol_table[global_variable_index].name, identifier_name,
-          sizeof(symbol_table[global_variable_index].name) - 1);
   symbol_table[global_variable_index].index = global_variable_index;
   symbol_table[global_variable_index].type = var_type;
+  symbol_table[global_variable_index].body_start_address = 0;
+  symbol_table[global_variable_index].arity = 0;
+  symbol_table[global_variable_index].function_index = 0;
 
   return global_variable_index++;
 }
 
-static void ParseOperator(const TokenType operation) {
+/// <literal a>; <literal b>; <operation> -> <literal (a <operation> b)>
+/// Returns false if the operands are not two integer literals or the
+/// operation would divide by zero at run time.
+static bool FoldConstants(const TokenType operation) {
+  size_t left_address = 0;
+  size_t right_address = 0;
+  ConstantType left_type = kConstantTypeNumber;
+  ConstantType right_type = kConstantTypeNumber;
+  int left = 0;
+  int right = 0;
+  int result = 0;
+  ConstantType result_type = kConstantTypeNumber;
+
+  if (peephole_count < 2) {
+    return false;
+  }
+
+  left_address = peephole_window[peephole_count - 2];
+  right_address = peephole_window[peephole_count - 1];
+
+  if (!ReadLiteral(left_address, &left, &left_type) ||
+      !ReadLiteral(right_address, &right, &right_type) ||
+      kConstantTypeNumber != left_type || kConstantTypeNumber != right_type) {
+    return false;
+  }
+
+  switch (operation) {
+    case kTokenPlus:
+      result = left + right;
+
+      break;
+    case kTokenMinus:
+      result = left - right;
+
+      break;
+    case kTokenStar:
+      result = left * right;
+
+      break;
+    case kTokenSlash:
+    case kTokenPercent:
+      if (0 == right) {
+        return false;
+      }
+
+      result = kTokenSlash == operation ? left / right : left % right;
+
+      break;
+    case kTokenEquals:
+      result = left == right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    case kTokenNotEquals:
+      result = left != right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    case kTokenGreaterThan:
+      result = left > right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    case kTokenGreaterOrEquals:
+      result = left >= right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    case kTokenLessThan:
+      result = left < right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    case kTokenLessOrEquals:
+      result = left <= right;
+      result_type = kConstantTypeBoolean;
+
+      break;
+    default:
+      return false;
+  }
+
+  RemoveLiteral(right_address);
+  RemoveLiteral(left_address);
+
+  peephole_count -= 2;
+
+  EmitLiteral(result, result_type);
+
+  return true;
+}
+
+/// Emits the opcode of a binary operator. If both operands are proven to be
+/// integers, the untagged *Int variant is used, or the operation is folded
+/// when both are literals.
+static void ParseOperator(const TokenType operation, const bool is_integer) {
+  if (is_integer && FoldConstants(operation)) {
+    return;
+  }
+
   switch (operation) {
     case kTokenPlus:
-      EmitByte(kOpAdd);
+      EmitOpcode(is_integer ? kOpAddInt : kOpAdd);
+      FuseLoadGlobalAddConst();
 
       break;
     case kTokenMinus:
-      EmitByte(kOpSubtract);
+      EmitOpcode(is_integer ? kOpSubtractInt : kOpSubtract);
 
       break;
     case kTokenStar:
-      EmitByte(kOpMultiply);
+      EmitOpcode(is_integer ? kOpMultiplyInt : kOpMultiply);
 
       break;
     case kTokenPercent:
-      EmitByte(kOpModulo);
+      EmitOpcode(is_integer ? kOpModuloInt : kOpModulo);
 
       break;
     case kTokenSlash:
-      EmitByte(kOpDivide);
+      EmitOpcode(is_integer ? kOpDivideInt : kOpDivide);
 
       break;
     case kTokenEquals:
-      EmitByte(kOpEquals);
+      EmitOpcode(is_integer ? kOpEqualsInt : kOpEquals);
 
       break;
     case kTokenNotEquals:
-      EmitByte(kOpNotEquals);
+      EmitOpcode(is_integer ? kOpNotEqualsInt : kOpNotEquals);
 
       break;
     case kTokenGreaterThan:
-      EmitByte(kOpGreaterThan);
+      EmitOpcode(is_integer ? kOpGreaterThanInt : kOpGreaterThan);
 
       break;
     case kTokenGreaterOrEquals:
-      EmitByte(kOpGreaterThanOrEqualTo);
+      EmitOpcode(is_integer ? kOpGreaterThanOrEqualToInt
+                            : kOpGreaterThanOrEqualTo);
 
       break;
     case kTokenLessThan:
-      EmitByte(kOpLessThan);
+      EmitOpcode(is_integer ? kOpLessThanInt : kOpLessThan);
 
       break;
     case kTokenLessOrEquals:
-      EmitByte(kOpLessThanOrEqualTo);
+      EmitOpcode(is_integer ? kOpLessThanOrEqualToInt
+                            : kOpLessThanOrEqualTo);
 
       break;
     default:
-      puts("Error: Undefined operator.");
+      ReportError("Error: Undefined operator.\n");
 
       token.type = kTokenEof;
   }
 }
 
 static VariableType ParseNumber(const int number) {
-  const size_t kIndex = AddNumberConstant(number, kConstantTypeNumber);
+  if (!EmitLiteral(number, kConstantTypeNumber)) {
+    return kVariableTypeUnknown;
+  }
 
-  EmitByte(kOpConstant);
-  EmitByte(kIndex);
   return kVariableTypeInt;
 }
 
 static VariableType ParseBoolean(const int boolean_value) {
-  const size_t kIndex = AddNumberConstant(boolean_value, kConstantTypeBoolean);
+  if (!EmitLiteral(boolean_value, kConstantTypeBoolean)) {
+    return kVariableTypeUnknown;
+  }
 
-  EmitByte(kOpConstant);
-  EmitByte(kIndex);
   return kVariableTypeBool;
 }
 
+/// Parses the arguments of a call up to the closing parenthesis and returns
+/// their count. The arguments of a call to the function at `symbol_index`
+/// must be of the declared types of its parameters, the arguments of a call
+/// with a `symbol_index` of (size_t)-1 aren't checked.
 // NOLINTNEXTLINE(misc-no-recursion)
-static void ParseFunctionCall() {
+static size_t ParseArguments(const size_t symbol_index) {
   size_t arity = 0;
+  VariableType argument_type = kVariableTypeUnknown;
+  VariableType parameter_type = kVariableTypeUnknown;
 
   while (token.type != kTokenRightParenthesis && token.type != kTokenEof) {
-    ParseExpression();
+    argument_type = ParseExpression();
+
+    if ((size_t)-1 != symbol_index &&
+        arity < symbol_table[symbol_index].arity) {
+      parameter_type = (VariableType)parameter_types
+          [symbol_table[symbol_index].function_index][arity];
+
+      if (argument_type != parameter_type) {
+        if (!IsReportedError(argument_type)) {
+          ReportError("Type error: Cannot pass %s as parameter of type %s.\n",
+                      VariableTypeToString(argument_type),
+                      VariableTypeToString(parameter_type));
+        }
+        token.type = kTokenEof;
+
+        return arity;
+      }
+    }
+
     ++arity;
 
     if (AcceptToken(1, kTokenRightParenthesis)) {
@@ -231,44 +771,88 @@ static void ParseFunctionCall() {
 
     if (!(AcceptToken(1, kTokenComma) &&
           ExpectToken(1, kTokenRightParenthesis))) {
-      return;
+      return arity;
     }
   }
 
-  EmitByte(kOpCallFunction);
-  EmitByte(arity);
+  return arity;
+}
+
+/// Calls the function value below the arguments on the stack.
+// NOLINTNEXTLINE(misc-no-recursion)
+static void ParseFunctionCall() {
+  const size_t kArity = ParseArguments((size_t)-1);
+
+  EmitOpcode(kOpCallFunction);
+  EmitByte(kArity);
+}
+
+/// Calls a function defined earlier in the program, or the one being defined,
+/// by its body address.
+// NOLINTNEXTLINE(misc-no-recursion)
+static VariableType ParseDirectFunctionCall(const Token* const identifier,
+                                            const size_t symbol_index) {
+  const size_t kArity = ParseArguments(symbol_index);
+
+  if (is_compile_error) {
+    return kVariableTypeUnknown;
+  }
+
+  if (symbol_table[symbol_index].arity != kArity) {
+    ReportError("Error: Function '%.*s' takes %u arguments.\n",
+                (int)identifier->length, TokenText(identifier),
+                (unsigned)symbol_table[symbol_index].arity);
+    token.type = kTokenEof;
+
+    return kVariableTypeUnknown;
+  }
+
+  EmitOpcode(kBytecodeFormatWide == bytecode_format ? kOpCallDirectWide
+                                                     : kOpCallDirect);
+  EmitAddress(symbol_table[symbol_index].body_start_address);
+  EmitByte(kArity);
+
+  return symbol_table[symbol_index].type;
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseIdentifier(const char* const identifier_name) {
+static VariableType ParseIdentifier(const Token* const identifier) {
   size_t index = 0;
   VariableType var_type = kVariableTypeUnknown;
 
-  index = FindLocalSymbol(identifier_name);
+  index = FindLocalSymbol(identifier);
 
   if ((size_t)-1 != index) {
-    EmitByte(kOpLoadLocal);
+    EmitOpcode(kOpLoadLocal);
     EmitByte((unsigned char)index);
     ++instruction_address;
-    var_type = kVariableTypeInt;
+    var_type = local_types[index];
   } else {
-    index = FindGlobalSymbol(identifier_name);
+    index = FindGlobalSymbol(identifier);
     if (index == (size_t)-1) {
-      printf("Error: Undefined symbol '%s'.\n", identifier_name);
+      ReportError("Error: Undefined symbol '%.*s'.\n",
+                  (int)identifier->length, TokenText(identifier));
       return kVariableTypeUnknown;
     }
 
-    EmitByte(kOpLoadGlobal);
-    EmitByte((unsigned char)index);
+    if (0 != symbol_table[index].body_start_address &&
+        AcceptToken(1, kTokenLeftParenthesis)) {
+      return ParseDirectFunctionCall(identifier, index);
+    }
+
+    EmitIndexedOpcode(kOpLoadGlobal, kOpLoadGlobalWide, index);
     ++instruction_address;
 
-    var_type = symbol_table[index].type;
+    // A function value isn't of the type the function returns.
+    var_type = 0 == symbol_table[index].body_start_address
+                   ? symbol_table[index].type
+                   : kVariableTypeUnknown;
   }
   if (AcceptToken(1, kTokenLeftBracket)) {
     VariableType index_type = ParseExpression();
 
     if (index_type != kVariableTypeInt) {
-      puts("Type error: Array index must be integer.");
+      ReportError("Type error: Array index must be integer.\n");
       token.type = kTokenEof;
       return kVariableTypeUnknown;
     }
@@ -281,16 +865,17 @@ static VariableType ParseIdentifier(const char* const identifier_name) {
       VariableType value_type = ParseExpression();
 
       if (value_type != kVariableTypeInt) {
-        puts("Type error: Only integer values can be assigned to arrays.");
+        ReportError(
+            "Type error: Only integer values can be assigned to arrays.\n");
         token.type = kTokenEof;
         return kVariableTypeUnknown;
       }
 
-      EmitByte(kOpStoreElement);
+      EmitOpcode(kOpStoreElement);
       EmitByte((unsigned char)index);
       return kVariableTypeInt;
     }
-    EmitByte(kOpIndexArray);
+    EmitOpcode(kOpIndexArray);
     return kVariableTypeInt;
   }
 
@@ -301,11 +886,11 @@ static VariableType ParseIdentifier(const char* const identifier_name) {
   return var_type;
 }
 
-static VariableType ParseString(const char* const string) {
-  const size_t kStringIndex = AddStringConstant(string);
+static VariableType ParseString(const Token* const string) {
+  if (!EmitConstant(AddStringConstant(TokenText(string), string->length))) {
+    return kVariableTypeUnknown;
+  }
 
-  EmitByte(kOpConstant);
-  EmitByte(kStringIndex);
   return kVariableTypeStr;
 }
 
@@ -317,19 +902,19 @@ static VariableType ParseFactor() {
   saved_token = token;
 
   if (AcceptToken(1, kTokenIdentifier)) {
-    return ParseIdentifier(saved_token.value.text);
+    return ParseIdentifier(&saved_token);
   }
 
   if (AcceptToken(1, kTokenNumber)) {
-    return ParseNumber(saved_token.value.number);
+    return ParseNumber(saved_token.number);
   }
 
   if (AcceptToken(1, kTokenBoolean)) {
-    return ParseBoolean(saved_token.value.number);
+    return ParseBoolean(saved_token.number);
   }
 
   if (AcceptToken(1, kTokenString)) {
-    return ParseString(saved_token.value.text);
+    return ParseString(&saved_token);
   }
 
   if (AcceptToken(1, kTokenLeftParenthesis)) {
@@ -337,112 +922,100 @@ static VariableType ParseFactor() {
     ExpectToken(1, kTokenRightParenthesis);
     return type;
   }
-  puts("Error: Invalid expression.");
+  ReportError("Error: Invalid expression.\n");
   token.type = kTokenEof;
   return kVariableTypeInt;
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseTerm() {
-  VariableType left_type = ParseFactor();
-  VariableType right_type = kVariableTypeUnknown;
-
-  while (kTokenStar == token.type || kTokenSlash == token.type ||
-         kTokenPercent == token.type) {
-    const TokenType kOperator = token.type;
-
-    ConsumeNextToken();
-    right_type = ParseFactor();
-    if (left_type != kVariableTypeInt || right_type != kVariableTypeInt) {
-      puts("Type error: Arithmetic operands must be integers.");
-      token.type = kTokenEof;
-    }
-
-    ParseOperator(kOperator);
-    left_type = kVariableTypeInt;
-  }
-  return left_type;
+/// Precedence of the token following an operand, which is kPrecedenceNone
+/// unless the token is a binary operator.
+static unsigned char BinaryPrecedence(const TokenType type) {
+  return kTokenGreaterOrEquals < type ? kPrecedenceNone
+                                      : kBinaryPrecedence[type];
 }
 
+/// Parses operands joined by the binary operators that bind at least as
+/// strong as `min_precedence`. Stronger operators are parsed by climbing in
+/// the loop, so a factor takes the same number of calls at every level.
 // NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseArithmeticExpression() {
+static VariableType ParseBinaryExpression(const unsigned char min_precedence) {
   VariableType left_type = kVariableTypeUnknown;
   VariableType right_type = kVariableTypeUnknown;
+  unsigned char max_precedence = kPrecedenceProduct;
+  unsigned char precedence = kPrecedenceNone;
+  bool is_integer = false;
+
+  if (kPrecedenceComparison >= min_precedence && AcceptToken(1, kTokenNot)) {
+    left_type = ParseBinaryExpression(kPrecedenceSum);
+    if (left_type != kVariableTypeBool) {
+      ReportError("Type error: 'not' requires boolean.\n");
+      token.type = kTokenEof;
+    }
+    ParseOperator(kTokenNot, false);
+    return kVariableTypeBool;
+  }
 
-  if (kTokenPlus == token.type || kTokenMinus == token.type) {
+  if (kPrecedenceSum >= min_precedence &&
+      (kTokenPlus == token.type || kTokenMinus == token.type)) {
     const TokenType kOperator = token.type;
 
     ConsumeNextToken();
-    left_type = ParseTerm();
+    left_type = ParseBinaryExpression(kPrecedenceProduct);
     if (left_type != kVariableTypeInt) {
-      puts("Type error: Unary operator requires integer.");
+      ReportError("Type error: Unary operator requires integer.\n");
       token.type = kTokenEof;
     }
 
-    ParseOperator(kOperator);
-    return kVariableTypeInt;
+    ParseOperator(kOperator, false);
+    left_type = kVariableTypeInt;
+
+    // A signed term is a whole sum, only a comparison may follow it.
+    max_precedence = kPrecedenceComparison;
+  } else {
+    left_type = ParseFactor();
   }
 
-  left_type = ParseTerm();
+  precedence = BinaryPrecedence(token.type);
 
-  while (kTokenPlus == token.type || kTokenMinus == token.type) {
+  while (min_precedence <= precedence && precedence <= max_precedence) {
     const TokenType kOperator = token.type;
 
     ConsumeNextToken();
-    right_type = ParseTerm();
-    if (left_type != kVariableTypeInt || right_type != kVariableTypeInt) {
-      puts("Type error: Arithmetic operands must be integers.");
-      token.type = kTokenEof;
-    }
-
-    ParseOperator(kOperator);
-    left_type = kVariableTypeInt;
-  }
-  return left_type;
-}
+    right_type = kPrecedenceProduct == precedence
+                     ? ParseFactor()
+                     : ParseBinaryExpression(precedence + 1);
+    is_integer =
+        kVariableTypeInt == left_type && kVariableTypeInt == right_type;
+
+    if (kPrecedenceComparison == precedence) {
+      if (!is_integer) {
+        ReportError("Type error: Comparison requires integers.\n");
+        token.type = kTokenEof;
+      }
+      ParseOperator(kOperator, is_integer);
 
-// NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseRelationalExpression() {
-  VariableType left_type = kVariableTypeUnknown;
-  VariableType right_type = kVariableTypeUnknown;
-  if (AcceptToken(1, kTokenNot)) {
-    VariableType operand_type = ParseArithmeticExpression();
-    if (operand_type != kVariableTypeBool) {
-      puts("Type error: 'not' requires boolean.");
-      token.type = kTokenEof;
+      // Comparisons don't chain.
+      return kVariableTypeBool;
     }
-    ParseOperator(kTokenNot);
-    return kVariableTypeBool;
-  }
 
-  left_type = ParseArithmeticExpression();
-
-  if (kTokenEquals == token.type || kTokenNotEquals == token.type ||
-      kTokenGreaterThan == token.type || kTokenGreaterOrEquals == token.type ||
-      kTokenLessThan == token.type || kTokenLessOrEquals == token.type) {
-    const TokenType kOperator = token.type;
-    ConsumeNextToken();
-    right_type = ParseArithmeticExpression();
-
-    if (left_type != kVariableTypeInt || right_type != kVariableTypeInt) {
-      puts("Type error: Comparison requires integers.");
+    if (!is_integer) {
+      ReportError("Type error: Arithmetic operands must be integers.\n");
       token.type = kTokenEof;
     }
-    ParseOperator(kOperator);
-    return kVariableTypeBool;
+
+    ParseOperator(kOperator, is_integer);
+    left_type = kVariableTypeInt;
+    precedence = BinaryPrecedence(token.type);
   }
   return left_type;
 }
 
 // TODO(Martin): Implement logical expressions.
 // NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseLogicalExpression() {
-  return ParseRelationalExpression();
+static VariableType ParseExpression() {
+  return ParseBinaryExpression(kPrecedenceComparison);
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-static VariableType ParseExpression() { return ParseLogicalExpression(); }
-
 // NOLINTNEXTLINE(misc-no-recursion)
 static void ParsePrintStatement() {
   if (!ExpectToken(1, kTokenLeftParenthesis)) {
@@ -455,32 +1028,111 @@ static void ParsePrintStatement() {
     return;
   }
 
-  EmitByte(kOpPrint);
+  EmitOpcode(kOpPrint);
 }
 
 // clang-format off
 #pragma static-locals(push, off)
 // clang-format on
+/// Removes the push of a condition that folded to a constant and returns true,
+/// with its truth value in `is_true`. Like kOpJumpIfFalse, only a false
+/// boolean counts as false.
+static bool RemoveConstantCondition(bool* const is_true) {
+  size_t address = 0;
+  int value = 0;
+  ConstantType constant_type = kConstantTypeNumber;
+
+  if (peephole_count < 1) {
+    return false;
+  }
+
+  address = peephole_window[peephole_count - 1];
+
+  if (!ReadLiteral(address, &value, &constant_type)) {
+    return false;
+  }
+
+  *is_true = kConstantTypeBoolean != constant_type || 0 != value;
+
+  RemoveLiteral(address);
+
+  --peephole_count;
+
+  return true;
+}
+
+/// Parses the statements of a block up to `end_token` or `else`. The code of
+/// a dead block is dropped again, unless it defines a function, whose body
+/// direct calls still jump into. Then the block is only jumped over.
+// NOLINTNEXTLINE(misc-no-recursion)
+static void ParseBlock(const TokenType end_token, const bool is_dead) {
+  const size_t kFirstSymbol = global_variable_index;
+  size_t jump_patch_slot = 0;
+  size_t index = 0;
+
+  if (is_dead) {
+    jump_patch_slot = EmitJump(0);
+  }
+
+  while (end_token != token.type && kTokenElse != token.type &&
+         kTokenEof != token.type) {
+    ParseStatement();
+  }
+
+  if (!is_dead) {
+    return;
+  }
+
+  for (index = kFirstSymbol; index < global_variable_index; ++index) {
+    if (0 != symbol_table[index].body_start_address) {
+      PatchJump(jump_patch_slot);
+
+      return;
+    }
+  }
+
+  // The jump opcode sits right in front of its target operand.
+  TruncateInstructions(jump_patch_slot - 1);
+  peephole_count = 0;
+}
+
+/// An if statement whose condition is known at compile time keeps only the
+/// branch that runs, without any jumps.
+// NOLINTNEXTLINE(misc-no-recursion)
+static void ParseConstantIfStatement(const bool is_true) {
+  ParseBlock(kTokenEndif, !is_true);
+
+  if (AcceptToken(1, kTokenElse)) {
+    ParseBlock(kTokenEndif, is_true);
+  }
+
+  ExpectToken(1, kTokenEndif);
+}
+
 // NOLINTNEXTLINE(misc-no-recursion)
 static void ParseIfStatement() {
   size_t condition_patch_slot = 0;
   size_t exit_patch_slot = 0;
+  VariableType condition_type = kVariableTypeUnknown;
+  bool is_true = false;
 
   if (!ExpectToken(1, kTokenLeftParenthesis)) {
     return;
   }
 
-  ParseExpression();
+  condition_type = ParseExpression();
 
   if (!ExpectToken(1, kTokenRightParenthesis)) {
     return;
   }
 
-  EmitByte(kOpJumpIfFalse);
+  if (RemoveConstantCondition(&is_true)) {
+    ParseConstantIfStatement(is_true);
 
-  condition_patch_slot = instruction_address;
+    return;
+  }
 
-  EmitByte(0);
+  condition_patch_slot = EmitJumpIfFalse(condition_type);
 
   while (kTokenEndif != token.type && kTokenElse != token.type &&
          kTokenEof != token.type) {
@@ -488,20 +1140,16 @@ static void ParseIfStatement() {
   }
 
   if (kTokenElse != token.type) {
-    instructions[condition_patch_slot] = instruction_address;
+    PatchJump(condition_patch_slot);
 
     ExpectToken(1, kTokenEndif);
 
     return;
   }
 
-  EmitByte(kOpJump);
-
-  exit_patch_slot = instruction_address;
+  exit_patch_slot = EmitJump(0);
 
-  EmitByte(0);
-
-  instructions[condition_patch_slot] = instruction_address;
+  PatchJump(condition_patch_slot);
 
   ConsumeNextToken();
 
@@ -509,7 +1157,7 @@ static void ParseIfStatement() {
     ParseStatement();
   }
 
-  instructions[exit_patch_slot] = instruction_address;
+  PatchJump(exit_patch_slot);
 
   ExpectToken(1, kTokenEndif);
 }
@@ -517,14 +1165,15 @@ static void ParseIfStatement() {
 #pragma static-locals(pop)
 // clang-format on
 
-static void DefineVariable(const char* const identifier_name,
+static void DefineVariable(const Token* const identifier,
                            const VariableType type, const bool is_local) {
   size_t symbol_index = 0;
 
   // const size_t kNameIndex = AddIdentifierConstant(identifier_name);
 
   if ((int)is_local && !is_function_scope) {
-    printf("Error: Cannot define local variable outside function scope.\n");
+    ReportError(
+        "Error: Cannot define local variable outside function scope.\n");
 
     token.type = kTokenEof;
 
@@ -532,70 +1181,80 @@ static void DefineVariable(const char* const identifier_name,
   }
 
   // if (is_local) {
-  //   EmitByte(kOpDefineLocal);
+  //   EmitOpcode(kOpDefineLocal);
   //   EmitByte(local_count++);
   //
   //   return;
   // }
 
-  symbol_index = AddSymbol(identifier_name, type);
+  symbol_index = AddSymbol(identifier, type);
+
+  // A redefinition still stores into the existing variable.
+  if ((size_t)-1 == symbol_index) {
+    symbol_index = FindGlobalSymbol(identifier);
+  }
 
-  EmitByte(kOpStoreGlobal);
-  EmitByte(symbol_index);
+  if ((size_t)-1 == symbol_index) {
+    token.type = kTokenEof;
+
+    return;
+  }
+
+  EmitIndexedOpcode(kOpStoreGlobal, kOpStoreGlobalWide, symbol_index);
   EmitByte(type);
 }
 
 static VariableType ParseArrayLiteral() {
   size_t element_count = 0;
   int value = 0;
-  size_t index = 0;
   if (!ExpectToken(1, kTokenLeftBracket)) {
     return kVariableTypeUnknown;
   }
 
   while (token.type != kTokenRightBracket && token.type != kTokenEof) {
     if (token.type != kTokenNumber) {
-      puts("Error: Only integers are supported in arrays.");
+      ReportError("Error: Only integers are supported in arrays.\n");
       token.type = kTokenEof;
       return kVariableTypeUnknown;
     }
 
-    value = token.value.number;
+    value = token.number;
     ConsumeNextToken();
 
-    index = AddNumberConstant(value, kConstantTypeNumber);
-    EmitByte(kOpConstant);
-    EmitByte(index);
+    if (!EmitLiteral(value, kConstantTypeNumber)) {
+      return kVariableTypeUnknown;
+    }
+
     ++element_count;
 
     if (token.type == kTokenComma) {
       ConsumeNextToken();
     } else if (token.type != kTokenRightBracket) {
-      puts("Error: Expected ',' or ']'");
+      ReportError("Error: Expected ',' or ']'\n");
       token.type = kTokenEof;
       return kVariableTypeUnknown;
     }
   }
 
   if (!ExpectToken(1, kTokenRightBracket)) {
-    puts("Error: Missing closing bracket for array.");
+    ReportError("Error: Missing closing bracket for array.\n");
     token.type = kTokenEof;
     return kVariableTypeUnknown;
   }
 
-  EmitByte(kOpMakeArray);
+  EmitOpcode(kOpMakeArray);
   EmitByte(element_count);
 
   return kVariableTypeArray;
 }
 
-static void SetVariable(const char* const identifier_name) {
+static void SetVariable(const Token* const identifier) {
   size_t index = 0;
 
-  index = FindLocalSymbol(identifier_name);
+  index = FindLocalSymbol(identifier);
 
   if (((size_t)-1 != index) && (int)is_function_scope) {
-    EmitByte(kOpStoreLocal);
+    EmitOpcode(kOpStoreLocal);
     EmitByte((unsigned char)index);
 
     // TODO(Martin): Implement type checker.
@@ -604,23 +1263,24 @@ static void SetVariable(const char* const identifier_name) {
     return;
   }
 
-  index = FindGlobalSymbol(identifier_name);
+  index = FindGlobalSymbol(identifier);
 
   if ((size_t)-1 == index) {
-    puts("Error: Symbol not found.");
+    ReportError("Error: Symbol not found.\n");
 
     return;
   }
 
-  EmitByte(kOpStoreGlobal);
-  EmitByte((unsigned char)index);
+  EmitIndexedOpcode(kOpStoreGlobal, kOpStoreGlobalWide, index);
 
   // TODO(Martin): Implement type checker.
   ++instruction_address;
+
+  FuseIncGlobal();
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
-static void ParseVariableDeclaration(const char* const identifier_name) {
+static void ParseVariableDeclaration(const Token* const identifier) {
   // bool is_local = false;
   VariableType variable_type = 0;
   VariableType expr_type = kVariableTypeUnknown;
@@ -637,7 +1297,7 @@ static void ParseVariableDeclaration(const char* const identifier_name) {
   }
 
   if (AcceptToken(1, kTokenFunc)) {
-    ParseFunctionDefinition(identifier_name, variable_type);
+    ParseFunctionDefinition(identifier, variable_type);
 
     return;
   }
@@ -648,32 +1308,35 @@ static void ParseVariableDeclaration(const char* const identifier_name) {
   }
 
   if (expr_type != variable_type) {
-    printf("Type error: Cannot assign %s to variable of type %s.\n",
-           VariableTypeToString(expr_type),
-           VariableTypeToString(variable_type));
+    if (!IsReportedError(expr_type)) {
+      ReportError("Type error: Cannot assign %s to variable of type %s.\n",
+                  VariableTypeToString(expr_type),
+                  VariableTypeToString(variable_type));
+    }
     token.type = kTokenEof;
     return;
   }
 
-  DefineVariable(identifier_name, variable_type, false);
+  DefineVariable(identifier, variable_type, false);
 }
 
-static void ParseVariableAssignment(const char* const identifier_name) {
+static void ParseVariableAssignment(const Token* const identifier) {
   VariableType expected_type = kVariableTypeUnknown;
   VariableType expr_type = kVariableTypeUnknown;
   size_t index = (size_t)-1;
   bool is_local = false;
 
   // Check for local variable
-  index = FindLocalSymbol(identifier_name);
+  index = FindLocalSymbol(identifier);
   if (index != (size_t)-1) {
-    expected_type = kVariableTypeInt;
+    expected_type = local_types[index];
     // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
     is_local = true;
   } else {
-    index = FindGlobalSymbol(identifier_name);
+    index = FindGlobalSymbol(identifier);
     if (index == (size_t)-1) {
-      printf("Error: Undefined variable '%s'.\n", identifier_name);
+      ReportError("Error: Undefined variable '%.*s'.\n",
+                  (int)identifier->length, TokenText(identifier));
       token.type = kTokenEof;
       return;
     }
@@ -682,24 +1345,27 @@ static void ParseVariableAssignment(const char* const identifier_name) {
   expr_type = ParseExpression();
 
   if (expr_type != expected_type) {
-    printf("Type error: Cannot assign %s to variable '%s' of type %s.\n",
-           VariableTypeToString(expr_type), identifier_name,
-           VariableTypeToString(expected_type));
+    if (!IsReportedError(expr_type)) {
+      ReportError(
+          "Type error: Cannot assign %s to variable '%.*s' of type %s.\n",
+          VariableTypeToString(expr_type), (int)identifier->length,
+          TokenText(identifier), VariableTypeToString(expected_type));
+    }
     token.type = kTokenEof;
     return;
   }
 
-  SetVariable(identifier_name);
+  SetVariable(identifier);
 }
 
 // NOLINTNEXTLINE(misc-no-recursion,readability-function-cognitive-complexity)
-static void ParseFunctionDefinition(const char* const identifier_name,
+static void ParseFunctionDefinition(const Token* const identifier,
                                     const VariableType return_type) {
   size_t symbol_address = 0;
   size_t arity = 0;
-  size_t arity_index = 0;
-  size_t jump_address = 0;
+  size_t jump_patch_slot = 0;
   size_t body_start_address = 0;
+  size_t parameter_index = 0;
 
   if (!ExpectToken(1, kTokenLeftParenthesis)) {
     return;
@@ -707,12 +1373,15 @@ static void ParseFunctionDefinition(const char* const identifier_name,
 
   is_function_scope = true;
 
+  ClearLocalSymbols();
+
   // Parse parameters
   while (token.type != kTokenRightParenthesis && token.type != kTokenEof) {
-    char parameter_identifier_name[kIdentifierNameLength];
+    Token parameter = {};
     VariableType parameter_type = 0;
 
-    ExtractIdentifierName(parameter_identifier_name);
+    // cppcheck-suppress redundantInitialization
+    parameter = token;
 
     if (!ExpectToken(1, kTokenIdentifier)) {
       return;
@@ -722,19 +1391,23 @@ static void ParseFunctionDefinition(const char* const identifier_name,
       return;
     }
 
-    // TODO(Martin): Implement type checker.
-    // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
     parameter_type = TokenTypeToVariableType(token.type);
 
     if (!ExpectToken(4, kTokenInt, kTokenStr, kTokenBool, kTokenFloat)) {
       return;
     }
 
-    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-    strncpy(local_names[arity], parameter_identifier_name,
-            sizeof(local_names[0]));
+    if (kLocalsSize <= local_count) {
+      ReportError("Error: Too many parameters.\n");
+      token.type = kTokenEof;
+
+      return;
+    }
+
+    local_symbols[parameter.number] = arity + 1;
+    local_types[local_count] = parameter_type;
+    local_identifiers[local_count++] = (size_t)parameter.number;
     ++arity;
-    ++local_count;
 
     if (AcceptToken(1, kTokenRightParenthesis)) {
       break;
@@ -753,56 +1426,138 @@ static void ParseFunctionDefinition(const char* const identifier_name,
   // parenthesis here.
   AcceptToken(1, kTokenRightParenthesis);
 
-  jump_address = instruction_address;
-  EmitByte(kOpJump);
-  EmitByte(0);
+  jump_patch_slot = EmitJump(0);
 
-  body_start_address = instruction_address;
-  EmitByte(kOpPushCallFrame);
+  body_start_address = MarkJumpTarget();
+  EmitOpcode(kOpPushCallFrame);
   EmitByte(arity);
   EmitByte(return_type);
 
-  // Emit kOpStoreLocal in reverse order for all arguments.
-  for (arity_index = arity; arity_index > 0; --arity_index) {
-    EmitByte(kOpStoreLocal);
-    EmitByte((unsigned char)arity_index - 1);
+  if (kFunctionPoolSize <= function_count) {
+    ReportError("Error: Too many functions.\n");
+    token.type = kTokenEof;
 
-    // TODO(Martin): Implement type checker.
-    ++instruction_address;
+    return;
+  }
+
+  // The symbol exists before the body is parsed, so the function can call
+  // itself. The arguments already are the first locals of the new frame.
+  symbol_address = AddSymbol(identifier, return_type);
+
+  if ((size_t)-1 == symbol_address) {
+    token.type = kTokenEof;
+
+    return;
+  }
+
+  for (parameter_index = 0; parameter_index < arity; ++parameter_index) {
+    parameter_types[function_count][parameter_index] =
+        (unsigned char)local_types[parameter_index];
   }
 
+  symbol_table[symbol_address].function_index = function_count++;
+  symbol_table[symbol_address].body_start_address = body_start_address;
+  symbol_table[symbol_address].arity = arity;
+
+  is_function_body = true;
+  body_return_type = return_type;
+  is_body_returned = false;
+
   while (kTokenEndfunc != token.type && kTokenEof != token.type) {
+    is_body_returned = kTokenRet == token.type;
     ParseStatement();
   }
 
+  is_function_body = false;
+
+  // A body that falls through to its end returns the value on top of the
+  // stack, which is the last argument.
+  if (!is_body_returned && kTokenEof != token.type &&
+      (0 == arity || local_types[arity - 1] != return_type)) {
+    ReportError("Type error: Function '%.*s' must end with 'ret'.\n",
+                (int)identifier->length, TokenText(identifier));
+    token.type = kTokenEof;
+  }
+
+  ClearLocalSymbols();
+
   if (!ExpectToken(1, kTokenEndfunc)) {
     return;
   }
 
-  EmitByte(kOpReturn);
+  EmitOpcode(kOpReturn);
 
   //
-  instructions[jump_address + 1] = instruction_address;
-
-  symbol_address = AddSymbol(identifier_name, return_type);
+  PatchJump(jump_patch_slot);
+
+  if (kBytecodeFormatWide == bytecode_format ||
+      kNarrowOperandMax < symbol_address) {
+    EmitOpcode(kOpDefineFunctionWide);
+    EmitByte((unsigned char)symbol_address);
+    EmitByte((unsigned char)(symbol_address >> 8));
+    EmitByte((unsigned char)body_start_address);
+    EmitByte((unsigned char)(body_start_address >> 8));
+  } else {
+    EmitOpcode(kOpDefineFunction);
+    EmitByte((unsigned char)symbol_address);
+    EmitAddress(body_start_address);
+  }
 
-  EmitByte(kOpDefineFunction);
-  EmitByte(symbol_address);
-  EmitByte(body_start_address);
   EmitByte(arity);
   EmitByte(return_type);
 }
 
+/// kOpCallDirect f n; kOpReturn -> kOpTailCallDirect f n
+static bool FuseTailCall() {
+  size_t address = 0;
+
+  if (!is_function_body || peephole_count < 1 ||
+      (kOpCallDirect != RecentOpcode(0) &&
+       kOpCallDirectWide != RecentOpcode(0))) {
+    return false;
+  }
+
+  address = peephole_window[peephole_count - 1];
+
+  // Only if nothing was appended to the result of the call.
+  if (address + 1 + kOperandCount[instructions[address]] !=
+      instruction_address) {
+    return false;
+  }
+
+  instructions[address] = kOpCallDirect == instructions[address]
+                              ? kOpTailCallDirect
+                              : kOpTailCallDirectWide;
+
+  return true;
+}
+
 static void ParseReturnStatement() {
-  ParseExpression();
-  EmitByte(kOpReturn);
+  const VariableType kType = ParseExpression();
+
+  if (is_function_body && kType != body_return_type) {
+    if (!IsReportedError(kType)) {
+      ReportError("Type error: Cannot return %s from function of type %s.\n",
+                  VariableTypeToString(kType),
+                  VariableTypeToString(body_return_type));
+    }
+    token.type = kTokenEof;
+
+    return;
+  }
+
+  if (FuseTailCall()) {
+    return;
+  }
+
+  EmitOpcode(kOpReturn);
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
-static void ParseIdentifierStatement(const char* const identifier_name) {
+static void ParseIdentifierStatement(const Token* const identifier) {
   VariableType value_type = kVariableTypeUnknown;
   if (AcceptToken(1, kTokenColon)) {
-    ParseVariableDeclaration(identifier_name);
+    ParseVariableDeclaration(identifier);
 
     return;
   }
@@ -812,7 +1567,7 @@ static void ParseIdentifierStatement(const char* const identifier_name) {
     size_t index = 0;
 
     if (index_type != kVariableTypeInt) {
-      puts("Type error: Array index must be integer.");
+      ReportError("Type error: Array index must be integer.\n");
       token.type = kTokenEof;
       return;
     }
@@ -828,38 +1583,39 @@ static void ParseIdentifierStatement(const char* const identifier_name) {
     value_type = ParseExpression();
 
     if (value_type != kVariableTypeInt) {
-      puts("Type error: Only integer values can be stored in arrays.");
+      ReportError(
+          "Type error: Only integer values can be stored in arrays.\n");
       token.type = kTokenEof;
       return;
     }
 
-    index = FindLocalSymbol(identifier_name);
+    index = FindLocalSymbol(identifier);
     if (index != (size_t)-1) {
-      EmitByte(kOpLoadLocal);
+      EmitOpcode(kOpLoadLocal);
       EmitByte((unsigned char)index);
     } else {
-      index = FindGlobalSymbol(identifier_name);
+      index = FindGlobalSymbol(identifier);
       if (index == (size_t)-1) {
-        printf("Error: Undefined variable '%s'.\n", identifier_name);
+        ReportError("Error: Undefined variable '%.*s'.\n",
+                    (int)identifier->length, TokenText(identifier));
         token.type = kTokenEof;
         return;
       }
 
-      EmitByte(kOpLoadGlobal);
-      EmitByte((unsigned char)index);
+      EmitIndexedOpcode(kOpLoadGlobal, kOpLoadGlobalWide, index);
     }
 
-    EmitByte(kOpStoreElement);
+    EmitOpcode(kOpStoreElement);
     return;
   }
 
   if (AcceptToken(1, kTokenAssign)) {
-    ParseVariableAssignment(identifier_name);
+    ParseVariableAssignment(identifier);
 
     return;
   }
 
-  puts("Error: Unexpected token after identifier.");
+  ReportError("Error: Unexpected token after identifier.\n");
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
@@ -868,8 +1624,8 @@ static void ParseForStatement() {
   size_t loop_condition_address = 0;
   size_t increment_start_address = 0;
   size_t jump_after_increment_patch = 0;
-  size_t after_loop_address = 0;
-  char identifier_name[kIdentifierNameLength];
+  VariableType condition_type = kVariableTypeUnknown;
+  Token identifier = {};
 
   if (!ExpectToken(1, kTokenLeftParenthesis)) {
     return;
@@ -877,7 +1633,9 @@ static void ParseForStatement() {
 
   // Parse variable declaration
   // Initializer example: i: int = 0
-  ExtractIdentifierName(identifier_name);
+  // cppcheck-suppress redundantInitialization
+  identifier = token;
+
   if (!ExpectToken(1, kTokenIdentifier)) {
     return;
   }
@@ -886,35 +1644,37 @@ static void ParseForStatement() {
     return;
   }
 
-  ParseVariableDeclaration(identifier_name);
+  ParseVariableDeclaration(&identifier);
 
   if (!ExpectToken(1, kTokenSemicolon)) {
-    puts("That's yap!: You're missing a semicolon after the initializer.");
+    ReportError(
+        "That's yap!: You're missing a semicolon after the initializer.\n");
     return;
   }
 
   // Parse condition address
-  loop_condition_address = instruction_address;
-  ParseExpression();  // Condition example: i < 3
+  loop_condition_address = MarkJumpTarget();
+  condition_type = ParseExpression();  // Condition example: i < 3
 
-  EmitByte(kOpJumpIfFalse);
-  jump_if_false_patch = instruction_address;
-  EmitByte(0);  // patched after loop body
+  // patched after loop body
+  jump_if_false_patch = EmitJumpIfFalse(condition_type);
 
   if (!ExpectToken(1, kTokenSemicolon)) {
-    puts("That's yap!: You're missing a semicolon after the condition.");
+    ReportError(
+        "That's yap!: You're missing a semicolon after the condition.\n");
     return;
   }
 
   // Parse increment & store increment skip address
   // Increment example: i = i + 1
-  EmitByte(kOpJump);
-  jump_after_increment_patch = instruction_address;
-  EmitByte(0);  // patched to skip increment on false condition
+  // patched to skip increment on false condition
+  jump_after_increment_patch = EmitJump(0);
 
-  increment_start_address = instruction_address;
+  increment_start_address = MarkJumpTarget();
+
+  // cppcheck-suppress redundantInitialization
+  identifier = token;
 
-  ExtractIdentifierName(identifier_name);
   if (!ExpectToken(1, kTokenIdentifier)) {
     return;
   }
@@ -923,18 +1683,17 @@ static void ParseForStatement() {
     return;
   }
 
-  ParseVariableAssignment(identifier_name);
+  ParseVariableAssignment(&identifier);
 
   if (!ExpectToken(1, kTokenRightParenthesis)) {
     return;
   }
 
   // Jump from end of increment back to condition
-  EmitByte(kOpJump);
-  EmitByte(loop_condition_address);
+  EmitJump(loop_condition_address);
 
   // Patch earlier jump to skip increment on first entry
-  instructions[jump_after_increment_patch] = instruction_address;
+  PatchJump(jump_after_increment_patch);
 
   // Parse loop body
   while (token.type != kTokenEndfor && token.type != kTokenEof) {
@@ -942,12 +1701,10 @@ static void ParseForStatement() {
   }
 
   // Jump from body to increment
-  EmitByte(kOpJump);
-  EmitByte(increment_start_address);
+  EmitJump(increment_start_address);
 
   // === PATCHING ===
-  after_loop_address = instruction_address;
-  instructions[jump_if_false_patch] = after_loop_address;
+  PatchJump(jump_if_false_patch);
 
   ExpectToken(1, kTokenEndfor);
 
@@ -958,9 +1715,11 @@ static void ParseForStatement() {
 static void ParseWhileStatement() {
   size_t loop_start_index = 0;
   size_t pending_loop_exit_slot = 0;
+  VariableType condition_type = kVariableTypeUnknown;
+  bool is_true = false;
 
   // Mark where the loop starts
-  loop_start_index = instruction_address;
+  loop_start_index = MarkJumpTarget();
 
   // Parse condition
   // condition example: i < 3
@@ -968,16 +1727,28 @@ static void ParseWhileStatement() {
     return;
   }
 
-  ParseExpression();
+  condition_type = ParseExpression();
 
   if (!ExpectToken(1, kTokenRightParenthesis)) {
     return;
   }
 
+  // A constant condition either never enters the loop or never leaves it.
+  if (RemoveConstantCondition(&is_true)) {
+    ParseBlock(kTokenEndwhile, !is_true);
+
+    if (is_true) {
+      EmitJump(loop_start_index);
+    }
+
+    ExpectToken(1, kTokenEndwhile);
+
+    return;
+  }
+
   // Emit conditional jump to exit if false
-  EmitByte(kOpJumpIfFalse);
-  pending_loop_exit_slot = instruction_address;
-  EmitByte(0);  // placeholder to be patched
+  // placeholder to be patched
+  pending_loop_exit_slot = EmitJumpIfFalse(condition_type);
 
   // Parse loop body
   while (token.type != kTokenEndwhile && token.type != kTokenEof) {
@@ -985,18 +1756,17 @@ static void ParseWhileStatement() {
   }
 
   // Jump back to start of loop
-  EmitByte(kOpJump);
-  EmitByte(loop_start_index);
+  EmitJump(loop_start_index);
 
   // Waiting for instruction jump to jump to loop exit
-  instructions[pending_loop_exit_slot] = instruction_address;
+  PatchJump(pending_loop_exit_slot);
 
   ExpectToken(1, kTokenEndwhile);
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
 static void ParseStatement() {
-  char identifier_name[kIdentifierNameLength];
+  Token identifier = {};
 
   if (AcceptToken(1, kTokenPrint)) {
     ParsePrintStatement();
@@ -1028,17 +1798,18 @@ static void ParseStatement() {
     return;
   }
 
-  ExtractIdentifierName(identifier_name);
+  // cppcheck-suppress redundantInitialization
+  identifier = token;
 
   if (AcceptToken(1, kTokenIdentifier)) {
     if (token.type == kTokenLeftBracket) {
-      VariableType result_type = ParseIdentifier(identifier_name);
+      VariableType result_type = ParseIdentifier(&identifier);
       (void)result_type;
       return;
     }
 
     if (kTokenColon == token.type || kTokenAssign == token.type) {
-      ParseIdentifierStatement(identifier_name);
+      ParseIdentifierStatement(&identifier);
 
       return;
     }
@@ -1046,25 +1817,678 @@ static void ParseStatement() {
     ParseExpression();
   }
 
-  printf("Error: Unregistered statement '%s'.\n", identifier_name);
+  ReportError("Error: Unregistered statement '%.*s'.\n",
+              (int)identifier.length, TokenText(&identifier));
 
   token.type = kTokenEof;
 }
 
-void ParseProgram() {
-#if defined(__CC65__) && !defined(NDEBUG)
-  StartTimerA();
-#endif
-
+static void ParseStatements() {
   ConsumeNextToken();
 
   while (kTokenEof != token.type) {
     ParseStatement();
   }
+}
+
+void ParseProgram() {
+  const size_t kSourceStart = program_buffer_index;
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StartSection(kSectionParse);
+#endif
+
+  is_address_overflow = false;
+  is_compile_error = false;
 
   ResetParserState();
+  ResetIdentifiers();
+  ParseStatements();
+
+  if (is_address_overflow) {
+    ResetParserState();
+    ResetInterpreterState();
+
+    bytecode_format = kBytecodeFormatWide;
+    program_buffer_index = kSourceStart;
+
+    ParseStatements();
+  }
+
+  // Leave room for the kOpHalt the caller emits.
+  if (kInstructionsSize <= instruction_address) {
+    ReportError("Error: Program too large.\n");
+
+    TruncateInstructions(0);
+  }
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StopSection(kSectionParse);
+#endif
+}
+
+/// Drops the code and symbols of a fragment that is compiled again or failed
+/// to compile.
+static void RemoveFragment(const size_t code_start, const size_t symbol_start,
+                           const size_t function_start) {
+  size_t id = 0;
+
+  for (id = 0; id < global_symbols_end; ++id) {
+    if (symbol_start < global_symbols[id]) {
+      global_symbols[id] = 0;
+    }
+  }
+
+  global_variable_index = symbol_start;
+  function_count = function_start;
+
+  ClearLocalSymbols();
+  TruncateInstructions(code_start);
+}
+
+bool ParseFragment() {
+  const size_t kSourceStart = program_buffer_index;
+  const size_t kCodeStart = instruction_address;
+  const size_t kSymbolStart = global_variable_index;
+  const size_t kFunctionStart = function_count;
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StartSection(kSectionParse);
+#endif
+
+  is_address_overflow = false;
+  is_compile_error = false;
+
+  // Code in front of the fragment is no candidate for a superinstruction.
+  peephole_count = 0;
+
+  ParseStatements();
+
+  // The code in front stays narrow, the VM runs both formats side by side.
+  if (is_address_overflow) {
+    RemoveFragment(kCodeStart, kSymbolStart, kFunctionStart);
+
+    bytecode_format = kBytecodeFormatWide;
+    program_buffer_index = kSourceStart;
+    peephole_count = 0;
+
+    ParseStatements();
+  }
+
+  if (kInstructionsSize <= instruction_address) {
+    ReportError("Error: Program too large.\n");
+  }
 
 #if defined(__CC65__) && !defined(NDEBUG)
-  StopTimerA();
+  StopSection(kSectionParse);
 #endif
+
+  if (is_compile_error) {
+    RemoveFragment(kCodeStart, kSymbolStart, kFunctionStart);
+
+    return false;
+  }
+
+  return true;
+}
+
+static void EmitRegisterByte(const unsigned char byte) {
+  if (kRegisterInstructionsSize <= register_instruction_address) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  register_instructions[register_instruction_address++] = byte;
+}
+
+static void EmitRegisterJumpAddress(const unsigned char stack_address) {
+  if (kRegisterPatchesSize <= register_patch_count) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  register_patch_slots[register_patch_count] = register_instruction_address;
+  register_patch_targets[register_patch_count] = stack_address;
+  ++register_patch_count;
+
+  EmitRegisterByte(0);
+}
+
+static unsigned char FrameRegister(const size_t slot) {
+  if (kRegisterBankSize <= slot) {
+    is_register_code_valid = false;
+  }
+
+  if (frame_size <= slot) {
+    frame_size = slot + 1;
+  }
+
+  return (unsigned char)((kRegisterBankFrame << kRegisterBankShift) |
+                         (slot & (kRegisterBankSize - 1)));
+}
+
+/// Global registers are the global variables themselves, but only the first
+/// bank of them can be addressed.
+static unsigned char GlobalRegister(const unsigned char index) {
+  if (kRegisterBankSize <= index) {
+    is_register_code_valid = false;
+  }
+
+  return (unsigned char)((kRegisterBankGlobal << kRegisterBankShift) | index);
+}
+
+static unsigned char ConstantRegister(const size_t index) {
+  if (2 * kRegisterBankSize <= index) {
+    is_register_code_valid = false;
+  }
+
+  if (kRegisterBankSize <= index) {
+    return (unsigned char)((kRegisterBankConstantHigh << kRegisterBankShift) |
+                           (index - kRegisterBankSize));
+  }
+
+  return (unsigned char)((kRegisterBankConstant << kRegisterBankShift) | index);
+}
+
+/// Returns the constant register holding an immediate operand of the stack
+/// code. Immediates are added to the constant pool on the way.
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static unsigned char ImmediateRegister(const int value,
+                                       const ConstantType constant_type) {
+  return ConstantRegister(AddNumberConstant(value, constant_type));
+}
+
+static void PushRegister(const unsigned char operand) {
+  if (kVirtualStackSize <= virtual_stack_depth) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  virtual_stack[virtual_stack_depth++] = operand;
+}
+
+static unsigned char PopRegister() {
+  if (0 == virtual_stack_depth) {
+    is_register_code_valid = false;
+
+    return 0;
+  }
+
+  return virtual_stack[--virtual_stack_depth];
+}
+
+/// Copies a virtual stack entry into the frame register of its position, so
+/// it no longer depends on the variable it was loaded from.
+static void MaterializeRegister(const size_t position) {
+  const unsigned char kSlot = FrameRegister(frame_parameter_count + position);
+
+  if (kSlot == virtual_stack[position]) {
+    return;
+  }
+
+  EmitRegisterByte(kRegisterOpMove);
+  EmitRegisterByte(kSlot);
+  EmitRegisterByte(virtual_stack[position]);
+
+  virtual_stack[position] = kSlot;
+}
+
+/// Materializes every entry below `depth` that still refers to `variable`.
+/// Returns true if there was at least one.
+static bool MaterializeAliases(const unsigned char variable,
+                               const size_t depth) {
+  size_t position = 0;
+  bool has_aliases = false;
+
+  for (position = 0; position < depth; ++position) {
+    if (variable == virtual_stack[position]) {
+      MaterializeRegister(position);
+
+      has_aliases = true;
+    }
+  }
+
+  return has_aliases;
+}
+
+static void TranslateBinaryOperation(const RegisterOpcode opcode) {
+  const unsigned char kRight = PopRegister();
+  const unsigned char kLeft = PopRegister();
+  const unsigned char kDestination =
+      FrameRegister(frame_parameter_count + virtual_stack_depth);
+
+  EmitRegisterByte(opcode);
+  result_slot = register_instruction_address;
+  EmitRegisterByte(kDestination);
+  EmitRegisterByte(kLeft);
+  EmitRegisterByte(kRight);
+
+  PushRegister(kDestination);
+}
+
+/// Stores the top of the virtual stack into a global or local register. If
+/// the value was computed by the previous instruction, that instruction
+/// writes the variable directly.
+static void TranslateStore(const unsigned char variable,
+                           const size_t previous_result_slot) {
+  const size_t kDepth = virtual_stack_depth - 1;
+  unsigned char source = 0;
+
+  if (0 == virtual_stack_depth) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  if (!MaterializeAliases(variable, kDepth) && 0 != previous_result_slot) {
+    register_instructions[previous_result_slot] = variable;
+
+    PopRegister();
+
+    return;
+  }
+
+  source = PopRegister();
+
+  if (variable != source) {
+    EmitRegisterByte(kRegisterOpMove);
+    EmitRegisterByte(variable);
+    EmitRegisterByte(source);
+  }
+}
+
+static void TranslateJumpIfFalse(const unsigned char stack_address,
+                                 const size_t previous_result_slot) {
+  const unsigned char kCondition = PopRegister();
+  size_t start = 0;
+
+  if (0 != previous_result_slot) {
+    start = previous_result_slot - 1;
+
+    if (kRegisterOpEquals <= register_instructions[start] &&
+        kRegisterOpLessThanOrEqualTo >= register_instructions[start]) {
+      register_instructions[start + 1] = (unsigned char)(
+          register_instructions[start] - kRegisterOpEquals + kOpEquals);
+      register_instructions[start] = kRegisterOpCompareJump;
+
+      EmitRegisterJumpAddress(stack_address);
+
+      return;
+    }
+  }
+
+  EmitRegisterByte(kRegisterOpJumpIfFalse);
+  EmitRegisterByte(kCondition);
+  EmitRegisterJumpAddress(stack_address);
+}
+
+static void TranslateCall(const size_t arity, const bool is_direct,
+                          const unsigned char body_start_address) {
+  const size_t kCallSize = is_direct ? arity : arity + 1;
+  size_t result_position = 0;
+  size_t first_argument = 0;
+  size_t position = 0;
+
+  if (virtual_stack_depth < kCallSize) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  // The result replaces the function value, or the first argument of a
+  // direct call.
+  result_position = virtual_stack_depth - kCallSize;
+  first_argument = virtual_stack_depth - arity;
+
+  // Arguments become the first frame registers of the callee. The callee may
+  // also change globals that pending operands below still refer to.
+  for (position = 0; position < virtual_stack_depth; ++position) {
+    if (first_argument <= position ||
+        (result_position > position &&
+         kRegisterBankGlobal ==
+             virtual_stack[position] >> kRegisterBankShift)) {
+      MaterializeRegister(position);
+    }
+  }
+
+  EmitRegisterByte(is_direct ? kRegisterOpCallDirect : kRegisterOpCall);
+  EmitRegisterByte(FrameRegister(frame_parameter_count + result_position));
+
+  if (is_direct) {
+    EmitRegisterJumpAddress(body_start_address);
+  } else {
+    EmitRegisterByte(virtual_stack[result_position]);
+  }
+
+  EmitRegisterByte((unsigned char)(frame_parameter_count + first_argument));
+  EmitRegisterByte((unsigned char)arity);
+
+  virtual_stack_depth = result_position;
+  PushRegister(FrameRegister(frame_parameter_count + result_position));
+}
+
+static void TranslateTailCall(const unsigned char body_start_address,
+                              const size_t arity) {
+  size_t position = 0;
+
+  if (virtual_stack_depth < arity) {
+    is_register_code_valid = false;
+
+    return;
+  }
+
+  for (position = virtual_stack_depth - arity; position < virtual_stack_depth;
+       ++position) {
+    MaterializeRegister(position);
+  }
+
+  virtual_stack_depth -= arity;
+
+  EmitRegisterByte(kRegisterOpTailCallDirect);
+  EmitRegisterJumpAddress(body_start_address);
+  EmitRegisterByte(
+      (unsigned char)(frame_parameter_count + virtual_stack_depth));
+  EmitRegisterByte((unsigned char)arity);
+}
+
+static void EnterRegisterFrame(const size_t parameter_count) {
+  frame_parameter_count = parameter_count;
+  frame_size = parameter_count;
+
+  EmitRegisterByte(kRegisterOpEnter);
+  frame_size_slot = register_instruction_address;
+  EmitRegisterByte(0);
+}
+
+static void LeaveRegisterFrame() {
+  if (frame_size_slot < register_instruction_address) {
+    register_instructions[frame_size_slot] = (unsigned char)frame_size;
+  }
+}
+
+/// Returns the stack code byte at `address`, or 0 behind the buffer.
+static unsigned char StackCodeByte(const size_t address) {
+  return address < kInstructionsSize ? instructions[address] : 0;
+}
+
+/// Marks all jump targets and function entries of the stack code. Returns
+/// false if it contains an unknown opcode.
+static bool FindJumpTargets() {
+  size_t address = 0;
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memset(is_jump_target, 0, sizeof(is_jump_target));
+
+  while (address < instruction_address) {
+    const unsigned char kOpcode = instructions[address];
+
+    if (kOpcodeCount <= kOpcode) {
+      return false;
+    }
+
+    switch (kOpcode) {
+      case kOpJump:
+      case kOpJumpIfFalse:
+      case kOpJumpIfFalseBool:
+        is_jump_target[StackCodeByte(address + 1)] = true;
+
+        break;
+      case kOpDefineFunction:
+        is_jump_target[StackCodeByte(address + 2)] = true;
+
+        break;
+      case kOpCallDirect:
+      case kOpTailCallDirect:
+        is_jump_target[StackCodeByte(address + 1)] = true;
+
+        break;
+      case kOpCompareGlobalConstJump:
+        is_jump_target[StackCodeByte(address + 4)] = true;
+
+        break;
+      default:
+        break;
+    }
+
+    address += 1 + kOperandCount[kOpcode];
+  }
+
+  return true;
+}
+
+// NOLINTNEXTLINE(readability-function-cognitive-complexity)
+static void TranslateInstruction(const size_t address,
+                                 const size_t previous_result_slot) {
+  const Opcode kOpcode = (Opcode)instructions[address];
+  const unsigned char kFirstOperand = StackCodeByte(address + 1);
+  const unsigned char kSecondOperand = StackCodeByte(address + 2);
+
+  switch (kOpcode) {
+    case kOpConstant:
+      PushRegister(ConstantRegister(kFirstOperand));
+
+      break;
+    case kOpPushSmallInt:
+      PushRegister(ImmediateRegister(kFirstOperand, kConstantTypeNumber));
+
+      break;
+    case kOpPushInt16:
+      PushRegister(ImmediateRegister(
+          (short)(kFirstOperand | (unsigned)kSecondOperand << 8),
+          kConstantTypeNumber));
+
+      break;
+    case kOpPushTrue:
+    case kOpPushFalse:
+      PushRegister(
+          ImmediateRegister(kOpPushTrue == kOpcode, kConstantTypeBoolean));
+
+      break;
+    case kOpAdd:
+    case kOpSubtract:
+    case kOpMultiply:
+    case kOpDivide:
+    case kOpModulo:
+    case kOpEquals:
+    case kOpNotEquals:
+    case kOpGreaterThan:
+    case kOpGreaterThanOrEqualTo:
+    case kOpLessThan:
+    case kOpLessThanOrEqualTo:
+      TranslateBinaryOperation(
+          (RegisterOpcode)(kOpcode - kOpAdd + kRegisterOpAdd));
+
+      break;
+    case kOpAddInt:
+    case kOpSubtractInt:
+    case kOpMultiplyInt:
+    case kOpDivideInt:
+    case kOpModuloInt:
+    case kOpEqualsInt:
+    case kOpNotEqualsInt:
+    case kOpGreaterThanInt:
+    case kOpGreaterThanOrEqualToInt:
+    case kOpLessThanInt:
+    case kOpLessThanOrEqualToInt:
+      TranslateBinaryOperation(
+          (RegisterOpcode)(kOpcode - kOpAddInt + kRegisterOpAdd));
+
+      break;
+    case kOpPrint:
+      EmitRegisterByte(kRegisterOpPrint);
+      EmitRegisterByte(PopRegister());
+
+      break;
+    case kOpJumpIfFalse:
+    case kOpJumpIfFalseBool:
+      TranslateJumpIfFalse(kFirstOperand, previous_result_slot);
+
+      break;
+    case kOpJump:
+      EmitRegisterByte(kRegisterOpJump);
+      EmitRegisterJumpAddress(kFirstOperand);
+
+      break;
+    case kOpHalt:
+      EmitRegisterByte(kRegisterOpHalt);
+
+      break;
+    case kOpStoreGlobal:
+      TranslateStore(GlobalRegister(kFirstOperand), previous_result_slot);
+
+      break;
+    case kOpLoadGlobal:
+      PushRegister(GlobalRegister(kFirstOperand));
+
+      break;
+    case kOpStoreLocal:
+      TranslateStore(FrameRegister(kFirstOperand), previous_result_slot);
+
+      break;
+    case kOpLoadLocal:
+      PushRegister(FrameRegister(kFirstOperand));
+
+      break;
+    case kOpDefineFunction:
+      LeaveRegisterFrame();
+
+      // Back to the top level frame, whose kRegisterOpEnter comes first.
+      is_register_function = false;
+      frame_parameter_count = 0;
+      frame_size = register_instructions[1];
+      frame_size_slot = 1;
+
+      EmitRegisterByte(kRegisterOpDefineFunction);
+      EmitRegisterByte(kFirstOperand);
+      EmitRegisterJumpAddress(kSecondOperand);
+      EmitRegisterByte(StackCodeByte(address + 3));
+
+      break;
+    case kOpCallFunction:
+      TranslateCall(kFirstOperand, false, 0);
+
+      break;
+    case kOpCallDirect:
+      TranslateCall(kSecondOperand, true, kFirstOperand);
+
+      break;
+    case kOpTailCallDirect:
+      TranslateTailCall(kFirstOperand, kSecondOperand);
+
+      break;
+    case kOpReturn:
+      EmitRegisterByte(kRegisterOpReturn);
+      EmitRegisterByte(0 == virtual_stack_depth
+                           ? FrameRegister(frame_parameter_count)
+                           : PopRegister());
+
+      break;
+    case kOpPushCallFrame:
+      if (is_register_function) {
+        is_register_code_valid = false;
+
+        break;
+      }
+
+      LeaveRegisterFrame();
+      is_register_function = true;
+      EnterRegisterFrame(kFirstOperand);
+
+      break;
+    case kOpPopCallFrame:
+      break;
+    case kOpLoadGlobalAddConst:
+      PushRegister(GlobalRegister(kFirstOperand));
+      PushRegister(ImmediateRegister(kSecondOperand, kConstantTypeNumber));
+      TranslateBinaryOperation(kRegisterOpAdd);
+
+      break;
+    case kOpIncGlobal:
+      MaterializeAliases(GlobalRegister(kFirstOperand), virtual_stack_depth);
+
+      EmitRegisterByte(kRegisterOpAdd);
+      EmitRegisterByte(GlobalRegister(kFirstOperand));
+      EmitRegisterByte(GlobalRegister(kFirstOperand));
+      EmitRegisterByte(ImmediateRegister(kSecondOperand, kConstantTypeNumber));
+
+      break;
+    case kOpCompareGlobalConstJump:
+      EmitRegisterByte(kRegisterOpCompareJump);
+      EmitRegisterByte(StackCodeByte(address + 3));
+      EmitRegisterByte(GlobalRegister(kFirstOperand));
+      EmitRegisterByte(ImmediateRegister(kSecondOperand, kConstantTypeNumber));
+      EmitRegisterJumpAddress(StackCodeByte(address + 4));
+
+      break;
+    default:
+      // Arrays only exist on the stack machine.
+      is_register_code_valid = false;
+
+      break;
+  }
+}
+
+bool GenerateRegisterCode() {
+  size_t address = 0;
+  size_t previous_result_slot = 0;
+  size_t index = 0;
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memset(register_instructions, 0, kRegisterInstructionsSize);
+
+  register_instruction_address = 0;
+  register_patch_count = 0;
+  virtual_stack_depth = 0;
+  is_register_function = false;
+  result_slot = 0;
+  is_register_code_valid =
+      kBytecodeFormatNarrow == bytecode_format && FindJumpTargets();
+
+  EnterRegisterFrame(0);
+
+  while (is_register_code_valid && address < instruction_address) {
+    const unsigned char kOpcode = instructions[address];
+
+    if (is_jump_target[address] && 0 != virtual_stack_depth) {
+      is_register_code_valid = false;
+
+      break;
+    }
+
+    register_addresses[address] = (unsigned char)register_instruction_address;
+
+    previous_result_slot = result_slot;
+    result_slot = 0;
+
+    TranslateInstruction(address, previous_result_slot);
+
+    address += 1 + kOperandCount[kOpcode];
+  }
+
+  for (index = 0; index < register_patch_count; ++index) {
+    if (instruction_address <= register_patch_targets[index]) {
+      is_register_code_valid = false;
+
+      break;
+    }
+
+    register_instructions[register_patch_slots[index]] =
+        register_addresses[register_patch_targets[index]];
+  }
+
+  if (is_register_function || !is_register_code_valid) {
+    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+    memset(register_instructions, 0, kRegisterInstructionsSize);
+
+    register_instruction_address = 0;
+
+    return false;
+  }
+
+  LeaveRegisterFrame();
+
+  return true;
 }
@@ -1,8 +1,23 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#ifdef __CC65__
+#include <stdbool.h>
+#endif
+
 void ResetParserState();
 
+/// Compiles the program in program_buffer from program_buffer_index on.
 void ParseProgram();
 
+/// Compiles the statements from program_buffer_index on and appends their
+/// code, keeping the symbols of everything compiled before. Returns false
+/// and leaves code and symbols as they were if an error is reported.
+bool ParseFragment();
+
+/// Translates the compiled stack code into register code for RunRegisterVm.
+/// Returns false for programs the register VM can't run, such as ones using
+/// arrays or the wide bytecode format.
+bool GenerateRegisterCode();
+
 #endif  // PARSER_H
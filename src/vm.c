@@ -1,34 +1,68 @@
+#ifndef __CC65__
+// Exposes clock_gettime in strict C mode.
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #include "vm.h"
 
 #ifdef __CC65__
 #include <stdbool.h>
 #endif
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef __CC65__
+#include <time.h>
+#endif
+
+#ifdef __CC65__
+#include <cbm.h>
+
+#include "benchmark.h"
+#endif
 
 #ifdef __CC65__
 enum {
-  kGlobalVariablesSize = 64,
   kCallFrameTableSize = 64,
   kConstantsSize = 128,
+  kConstantTableSize = 256,
   kStringPoolSize = 512,
   kNumberPoolSize = 64,
-  kStackSize = 16,
-  kFunctionPoolSize = 16,
+  kStackSize = 64,
   kArrayPoolSize = 16,
-  kArrayElementsMax = 16
+  kArrayElementsMax = 16,
+  kImageVersion = 1,
+  kImageHeaderSize = 5,
+  kImageDevice = 8,
+  kImageFile = 2
 };
 #else
-static constexpr int kGlobalVariablesSize = 64;
 static constexpr int kCallFrameTableSize = 64;
-static constexpr int kConstantsSize = 128;
-static constexpr int kStringPoolSize = 512;
-static constexpr int kNumberPoolSize = 64;
-static constexpr int kStackSize = 16;
-static constexpr int kFunctionPoolSize = 16;
+static constexpr int kConstantsSize = 1024;
+static constexpr int kConstantTableSize = 2048;
+static constexpr int kStringPoolSize = 4096;
+static constexpr int kNumberPoolSize = 512;
+static constexpr int kStackSize = 256;
 static constexpr int kArrayPoolSize = 16;
 static constexpr int kArrayElementsMax = 16;
+static constexpr int kImageVersion = 1;
+static constexpr int kImageHeaderSize = 5;
+static constexpr int kDispatchTableSize = 256;
+
+#endif
+
+#ifdef VM_PROFILE
+#ifdef __CC65__
+enum { kProfilePairsSize = 256, kProfileReportPairs = 16 };
+#else
+static constexpr int kProfilePairsSize = 4096;
+static constexpr int kProfileReportPairs = 16;
+#endif
+#endif
 
+#ifndef __CC65__
+static constexpr unsigned long kNanosecondsPerSecond = 1000000000;
 #endif
 
 /// Pushes a value onto the stack.
@@ -50,6 +84,88 @@ static constexpr int kArrayElementsMax = 16;
   (0 == stack_index ? (puts("Error: Stack underflow."), kEmptyStackValue) \
                     : stack[--stack_index])
 
+#if defined(VM_DIRECT_THREADING) || \
+    (defined(__GNUC__) && !defined(__CC65__) && !defined(VM_SWITCH_DISPATCH))
+/// Dispatch through a table of label addresses instead of the portable
+/// switch statement. Every handler ends with its own indirect jump to the next
+/// handler, which gives the branch predictor one slot per opcode instead of a
+/// single shared one. Requires the GNU labels-as-values extension.
+#define VM_THREADED_DISPATCH
+#endif
+
+#ifdef VM_PROFILE
+/// Counts and times the opcode about to run.
+#define VmProfileNext() ProfileOpcode(instructions[program_counter])
+#else
+#define VmProfileNext() (void)0
+#endif
+
+#ifdef VM_DIRECT_THREADING
+/// Reads the next operand from the pre-translated instruction stream.
+#define VmReadOperand() (threaded_code[program_counter++].operand)
+
+/// Reads a two-byte little-endian operand from the pre-translated stream.
+#define VmReadWideOperand()                       \
+  (program_counter += 2,                          \
+   threaded_code[program_counter - 2].operand |   \
+       (threaded_code[program_counter - 1].operand << 8))
+
+/// Jumps directly to the handler address stored in the translated stream.
+/// The opcode byte stays in the instruction buffer for the profiler.
+#define VmDispatch()                                \
+  do {                                              \
+    VmProfileNext();                                \
+    goto* threaded_code[program_counter++].handler; \
+  } while (0)
+#else
+/// Reads the next operand byte from the instruction stream.
+#define VmReadOperand() (instructions[program_counter++])
+
+/// Reads a two-byte little-endian operand from the instruction stream.
+#define VmReadWideOperand()                             \
+  (program_counter += 2,                                \
+   (size_t)instructions[program_counter - 2] |          \
+       ((size_t)instructions[program_counter - 1] << 8))
+
+#ifdef VM_THREADED_DISPATCH
+/// Jumps to the handler of the next opcode through the dispatch table.
+#define VmDispatch()                                         \
+  do {                                                       \
+    VmProfileNext();                                         \
+    goto* kDispatchTable[instructions[program_counter++]]; \
+  } while (0)
+#else
+/// Leaves the switch statement to fetch the next opcode.
+#define VmDispatch() break
+#endif
+#endif
+
+/// Reads the next operand byte of the register instruction stream.
+#define RegisterVmReadOperand() (register_instructions[program_counter++])
+
+#ifdef VM_THREADED_DISPATCH
+/// The register VM always uses the byte stream, also when the stack machine
+/// runs direct-threaded code.
+#define RegisterVmDispatch() \
+  goto* kDispatchTable[register_instructions[program_counter++]]
+#else
+#define RegisterVmDispatch() break
+#endif
+
+/// Reads a register operand and resolves it to the value it names.
+#define VmReadRegister()                                       \
+  (register_operand = RegisterVmReadOperand(),                 \
+   &register_banks[register_operand >> kRegisterBankShift]     \
+                  [register_operand & (kRegisterBankSize - 1)])
+
+#ifdef VM_THREADED_DISPATCH
+#define VmCase(opcode) opcode##Handler
+#define VmDefault VmUndefinedHandler
+#else
+#define VmCase(opcode) case opcode
+#define VmDefault default
+#endif
+
 typedef struct Constants {
   const void* pointer[kConstantsSize];
   ConstantType type[kConstantsSize];
@@ -90,6 +206,74 @@ typedef struct CallFrame {
   size_t arity[kCallFrameTableSize];
 } CallFrame;
 
+#ifdef VM_DIRECT_THREADING
+typedef union ThreadedCell {
+  const void* handler;
+  size_t operand;
+} ThreadedCell;
+#endif
+
+const unsigned char kOperandCount[kOpcodeCount] = {
+    1,  // kOpConstant
+    0,  // kOpAdd
+    0,  // kOpSubtract
+    0,  // kOpMultiply
+    0,  // kOpDivide
+    0,  // kOpModulo
+    0,  // kOpEquals
+    0,  // kOpNotEquals
+    0,  // kOpGreaterThan
+    0,  // kOpGreaterThanOrEqualTo
+    0,  // kOpLessThan
+    0,  // kOpLessThanOrEqualTo
+    0,  // kOpPrint
+    1,  // kOpJumpIfFalse
+    1,  // kOpJump
+    0,  // kOpHalt
+    2,  // kOpStoreGlobal
+    2,  // kOpLoadGlobal
+    2,  // kOpStoreLocal
+    2,  // kOpLoadLocal
+    4,  // kOpDefineFunction
+    1,  // kOpCallFunction
+    0,  // kOpReturn
+    2,  // kOpPushCallFrame
+    0,  // kOpPopCallFrame
+    1,  // kOpMakeArray
+    0,  // kOpIndexArray
+    1,  // kOpStoreElement
+    2,  // kOpLoadGlobalAddConst
+    2,  // kOpIncGlobal
+    4,  // kOpCompareGlobalConstJump
+    2,  // kOpConstantWide
+    2,  // kOpJumpIfFalseWide
+    2,  // kOpJumpWide
+    3,  // kOpStoreGlobalWide
+    3,  // kOpLoadGlobalWide
+    6,  // kOpDefineFunctionWide
+    0,  // kOpAddInt
+    0,  // kOpSubtractInt
+    0,  // kOpMultiplyInt
+    0,  // kOpDivideInt
+    0,  // kOpModuloInt
+    0,  // kOpEqualsInt
+    0,  // kOpNotEqualsInt
+    0,  // kOpGreaterThanInt
+    0,  // kOpGreaterThanOrEqualToInt
+    0,  // kOpLessThanInt
+    0,  // kOpLessThanOrEqualToInt
+    1,  // kOpJumpIfFalseBool
+    2,  // kOpJumpIfFalseBoolWide
+    2,  // kOpCallDirect
+    3,  // kOpCallDirectWide
+    2,  // kOpTailCallDirect
+    3,  // kOpTailCallDirectWide
+    1,  // kOpPushSmallInt
+    2,  // kOpPushInt16
+    0,  // kOpPushTrue
+    0,  // kOpPushFalse
+};
+
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
 static StackValue global_variables[kGlobalVariablesSize];
 size_t global_variable_index = 0;
@@ -99,10 +283,23 @@ static size_t call_frame_index = 0;
 
 unsigned char instructions[kInstructionsSize];
 size_t instruction_address = 0;
+BytecodeFormat bytecode_format = kBytecodeFormatNarrow;
 
 static Constants constants;
 size_t constants_index = 0;
 
+/// Hash index over the constant pool with linear probing, so every distinct
+/// value is stored once. A slot holds a constant index plus one, zero marks an
+/// empty slot. It has twice as many slots as the pool, so it never fills up.
+static size_t constant_table[kConstantTableSize];
+
+/// Number of literals referring to each constant, up to UCHAR_MAX.
+static unsigned char constant_references[kConstantsSize];
+
+/// One past the highest constant index used since the last reset. It stays
+/// behind constants that were discarded again.
+static size_t constants_high_water_mark = 0;
+
 static char string_pool[kStringPoolSize];
 static size_t string_pool_index = 0;
 
@@ -118,33 +315,99 @@ static size_t stack_index = 0;
 static Array array_pool[kArrayPoolSize];
 static size_t array_pool_index = 0;
 
+unsigned char register_instructions[kRegisterInstructionsSize];
+size_t register_instruction_address = 0;
+
+/// Constants converted to stack values, so the register VM can address them
+/// like any other register.
+static StackValue constant_registers[2 * kRegisterBankSize];
+
+#ifndef __CC65__
+static FILE* image_file = nullptr;
+#endif
+
+#ifdef VM_DIRECT_THREADING
+/// Instruction stream with every opcode replaced by its handler address.
+/// Operands stay at their original index, so jump targets and function body
+/// addresses need no relocation.
+static ThreadedCell threaded_code[kInstructionsSize];
+#endif
+
+#ifdef VM_PROFILE
+static unsigned long opcode_counts[kOpcodeCount];
+static unsigned long opcode_ticks[kOpcodeCount];
+
+/// Counts of adjacent opcodes, hashed by their key
+/// `previous * kOpcodeCount + next` with linear probing. A slot with a zero
+/// count is empty. Pairs that find no slot are only counted as dropped.
+static unsigned short pair_keys[kProfilePairsSize];
+static unsigned long pair_counts[kProfilePairsSize];
+static unsigned long dropped_pairs = 0;
+
+/// The opcode running since profile_clock, kOpcodeCount if there is none.
+static unsigned char profiled_opcode = kOpcodeCount;
+static unsigned long profile_clock = 0;
+#endif
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
+static size_t FindNumberSlot(int value, ConstantType constant_type);
+
+static size_t FindStringSlot(const char* string, size_t length);
+
+/// Empties the constant table slots of all constants in use. Going from the
+/// newest constant back, the probe sequence of each one is still intact.
+/// Discarded constants may find the slot of a live one and leave it alone.
+static void ClearConstantTable() {
+  size_t index = constants_high_water_mark;
+
+  while (0 != index) {
+    const char* const kText = (const char*)constants.pointer[--index];
+    const size_t kSlot =
+        kConstantTypeString == constants.type[index]
+            ? FindStringSlot(kText, strlen(kText))
+            : FindNumberSlot(*(const int*)kText, constants.type[index]);
+
+    if (index + 1 == constant_table[kSlot]) {
+      constant_table[kSlot] = 0;
+    }
+  }
+}
+
+/// Clears only what was used since the last reset. Everything else is zero
+/// already, or is written before it is read: the call frames, the stack and
+/// the string and number pools.
 void ResetInterpreterState() {
+  ClearConstantTable();
+
   // NOLINTBEGIN(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  memset(global_variables, 0, kGlobalVariablesSize);
-  memset(call_frames.return_address, 0, kCallFrameTableSize);
-  memset(call_frames.arity, 0, kCallFrameTableSize);
-  memset(call_frames.stack_offset, 0, kCallFrameTableSize);
-  memset(instructions, 0, kInstructionsSize);
-  memset(&constants.pointer, 0, kConstantsSize);
-  memset(constants.type, 0, kConstantsSize);
-  memset(string_pool, 0, kStringPoolSize);
-  memset(number_pool, 0, kNumberPoolSize);
-  memset(stack, 0, kStackSize * sizeof(StackValue));
+  memset(global_variables, 0, global_variable_index * sizeof(StackValue));
+  // The parser zeroes the instructions it truncates, so none are set behind
+  // instruction_address. The same holds for the register code.
+  memset(instructions, 0, instruction_address);
+  memset(register_instructions, 0, register_instruction_address);
+  // The register VM loads constants up to the first null pointer.
+  memset(constants.pointer, 0,
+         constants_high_water_mark * sizeof(constants.pointer[0]));
   // NOLINTEND(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
 
+  constants_high_water_mark = 0;
   global_variable_index = 0;
   call_frame_index = 0;
   instruction_address = 0;
+  bytecode_format = kBytecodeFormatNarrow;
   constants_index = 0;
   string_pool_index = 0;
   number_pool_index = 0;
   function_pool_index = 0;
   stack_index = 0;
+  register_instruction_address = 0;
 }
 
 void EmitByte(const unsigned char byte) {
+  if (kInstructionsSize <= instruction_address) {
+    return;
+  }
+
   instructions[instruction_address++] = byte;
 }
 
@@ -156,235 +419,872 @@ void EmitHalt() {
 }
 
 void RemoveHalt() {
-  if (kOpHalt == instructions[instruction_address - 1]) {
-    instructions[instruction_address--] = 0;
+  if (0 != instruction_address &&
+      kOpHalt == instructions[instruction_address - 1]) {
+    instructions[--instruction_address] = 0;
+  }
+}
+
+/// Returns the slot of the number or boolean constant with this value, or the
+/// empty slot it belongs in.
+// NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
+static size_t FindNumberSlot(const int value,
+                             const ConstantType constant_type) {
+  size_t slot =
+      ((size_t)value * 31U + constant_type) & (kConstantTableSize - 1);
+
+  while (0 != constant_table[slot]) {
+    const size_t kIndex = constant_table[slot] - 1;
+
+    if (constant_type == constants.type[kIndex] &&
+        value == *(const int*)constants.pointer[kIndex]) {
+      break;
+    }
+
+    slot = (slot + 1) & (kConstantTableSize - 1);
+  }
+
+  return slot;
+}
+
+/// Returns the slot of the string constant with this text, or the empty slot
+/// it belongs in.
+static size_t FindStringSlot(const char* const string, const size_t length) {
+  size_t slot = kConstantTypeString;
+  size_t index = 0;
+
+  for (index = 0; index < length; ++index) {
+    slot = slot * 31U + (unsigned char)string[index];
+  }
+
+  slot &= kConstantTableSize - 1;
+
+  while (0 != constant_table[slot]) {
+    const size_t kIndex = constant_table[slot] - 1;
+    const char* const kText = (const char*)constants.pointer[kIndex];
+
+    if (kConstantTypeString == constants.type[kIndex] &&
+        0 == strncmp(string, kText, length) && '\0' == kText[length]) {
+      break;
+    }
+
+    slot = (slot + 1) & (kConstantTableSize - 1);
+  }
+
+  return slot;
+}
+
+/// Notes that the constant about to be added at constants_index is in use.
+static void RaiseConstantsHighWaterMark() {
+  if (constants_high_water_mark <= constants_index) {
+    constants_high_water_mark = constants_index + 1;
+  }
+}
+
+/// Returns the constant of an interned slot and counts the new reference.
+static size_t ReuseConstant(const size_t slot) {
+  const size_t kIndex = constant_table[slot] - 1;
+
+  if (UCHAR_MAX != constant_references[kIndex]) {
+    ++constant_references[kIndex];
   }
+
+  return kIndex;
 }
 
 // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
 size_t AddNumberConstant(const int value, const ConstantType constant_type) {
-  // TODO(Martin): Add check for number_pool overflow.
-  // TODO(Martin): Can't return -1 due to size_t return type
-  // if (number_pool_index + 1 >= kNumberPoolSize) {
-  //   return -1;
-  // }
+  const size_t kSlot = FindNumberSlot(value, constant_type);
+
+  if (0 != constant_table[kSlot]) {
+    return ReuseConstant(kSlot);
+  }
+
+  if (kConstantsSize <= constants_index ||
+      kNumberPoolSize <= number_pool_index) {
+    return (size_t)-1;
+  }
 
   number_pool[number_pool_index] = value;
 
   constants.pointer[constants_index] = &number_pool[number_pool_index];
   constants.type[constants_index] = constant_type;
+  constant_references[constants_index] = 1;
+  constant_table[kSlot] = constants_index + 1;
 
   ++number_pool_index;
 
+  RaiseConstantsHighWaterMark();
+
   return constants_index++;
 }
 
-size_t AddStringConstant(const char* const string) {
-  const size_t kStringLength = strlen(string);
+ConstantType GetConstantType(const size_t index) {
+  return constants.type[index];
+}
+
+int GetNumberConstant(const size_t index) {
+  return *(const int*)constants.pointer[index];
+}
+
+void DiscardNumberConstant(const size_t index) {
+  if (constants_index <= index ||
+      (kConstantTypeNumber != constants.type[index] &&
+       kConstantTypeBoolean != constants.type[index])) {
+    return;
+  }
+
+  if (UCHAR_MAX != constant_references[index]) {
+    --constant_references[index];
+  }
+
+  if (0 != constant_references[index] || index + 1 != constants_index) {
+    return;
+  }
+
+  // Nothing was added behind the last constant, so its slot ends every probe
+  // sequence through it and can simply be emptied.
+  constant_table[FindNumberSlot(GetNumberConstant(index),
+                                constants.type[index])] = 0;
+
+  --constants_index;
+  --number_pool_index;
+}
+
+size_t AddStringConstant(const char* const string, const size_t length) {
+  const size_t kSlot = FindStringSlot(string, length);
 #ifdef __CC65__
   char* current_string_pool_pointer = NULL;
 #else
   char* current_string_pool_pointer = nullptr;
 #endif
 
-  // TODO(Martin): Add check for string_pool overflow
-  // TODO(Martin): Can't return -1 due to size_t return type
-  // if (string_pool_index + kStringLength + 1 > kStringPoolSize) {
-  //   return -1;
-  // }
+  if (0 != constant_table[kSlot]) {
+    return ReuseConstant(kSlot);
+  }
+
+  if (kConstantsSize <= constants_index ||
+      kStringPoolSize < string_pool_index + length + 1) {
+    return (size_t)-1;
+  }
 
   current_string_pool_pointer = &string_pool[string_pool_index];
 
   // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-  strncpy(current_string_pool_pointer, string, kStringLength);
+  memcpy(current_string_pool_pointer, string, length);
+  current_string_pool_pointer[length] = '\0';
 
   constants.pointer[constants_index] = current_string_pool_pointer;
   constants.type[constants_index] = kConstantTypeString;
+  constant_references[constants_index] = 1;
+  constant_table[kSlot] = constants_index + 1;
 
-  string_pool_index += kStringLength + 1;
+  string_pool_index += length + 1;
+
+  RaiseConstantsHighWaterMark();
 
   return constants_index++;
 }
 
-static void PushCallFrame(const Function* const function) {
-  call_frames.return_address[call_frame_index] = instruction_address;
-  call_frames.arity[call_frame_index] = function->arity;
-  call_frames.stack_offset[call_frame_index] =
-      stack_index - function->arity - 1;
+/// Bytecode images start with these three characters, followed by
+/// kImageVersion and the bytecode format.
+static const char kImageMagic[] = "YBC";
 
-  instruction_address = function->body_start_index;
+/// The C128 opens the image as a program file through the KERNAL, natively it
+/// is an ordinary file.
+static bool OpenImage(const char* const name, const bool is_write) {
+#ifdef __CC65__
+  return 0 ==
+         cbm_open(kImageFile, kImageDevice, is_write ? CBM_WRITE : CBM_READ,
+                  name);
+#else
+  image_file = fopen(name, is_write ? "wb" : "rb");
 
-  ++call_frame_index;
+  return nullptr != image_file;
+#endif
 }
 
-static void PopCallFrame(const StackValue* const stack_value) {
-  --call_frame_index;
-
-  stack_index = call_frames.stack_offset[call_frame_index];
-
-  Push(*stack_value);
+static void CloseImage() {
+#ifdef __CC65__
+  cbm_close(kImageFile);
+#else
+  fclose(image_file);
+#endif
+}
 
-  instruction_address = call_frames.return_address[call_frame_index];
+static bool WriteImage(const void* const data, const size_t size) {
+#ifdef __CC65__
+  return (int)size == cbm_write(kImageFile, data, size);
+#else
+  return size == fwrite(data, 1, size, image_file);
+#endif
 }
 
-void PrintOpcodes() {
+static bool ReadImage(void* const data, const size_t size) {
 #ifdef __CC65__
-  static const size_t kRowLength = 8;
+  return (int)size == cbm_read(kImageFile, data, size);
 #else
-  static constexpr size_t kRowLength = 8;
+  return size == fread(data, 1, size, image_file);
 #endif
+}
 
-  size_t index = 0;
+static bool WriteImageByte(const unsigned char byte) {
+  return WriteImage(&byte, 1);
+}
 
-  if (0 == instruction_address) {
-    puts("No opcodes.");
+/// Sizes and string lengths are two bytes, little-endian like the operands.
+static bool WriteImageWord(const size_t word) {
+  const unsigned char kBytes[2] = {(unsigned char)word,
+                                   (unsigned char)(word >> 8)};
 
-    return;
+  return WriteImage(kBytes, sizeof(kBytes));
+}
+
+static bool ReadImageWord(size_t* const word) {
+  unsigned char bytes[2] = {0, 0};
+
+  if (!ReadImage(bytes, sizeof(bytes))) {
+    return false;
   }
 
-  for (index = 0; index < instruction_address; ++index) {
-    if (0 != index && 0 == index % kRowLength) {
-      puts("");
-    }
+  *word = (size_t)bytes[0] | (size_t)bytes[1] << 8;
 
-    if (0 != index && 0 != index % kRowLength) {
-      putchar(' ');
-    }
+  return true;
+}
 
-    printf("%d", instructions[index]);
-  }
+/// Numbers are four bytes in two's complement, so the C128 and the native
+/// build read each other's images as long as the values fit an int.
+static bool WriteImageNumber(const int number) {
+  const uint32_t kNumber = (uint32_t)(int32_t)number;
+  const unsigned char kBytes[4] = {
+      (unsigned char)kNumber, (unsigned char)(kNumber >> 8),
+      (unsigned char)(kNumber >> 16), (unsigned char)(kNumber >> 24)};
 
-  puts("");
+  return WriteImage(kBytes, sizeof(kBytes));
 }
 
-// NOLINTNEXTLINE(readability-function-cognitive-complexity)
-void RunVm() {
-  instruction_address = 0;
+static bool ReadImageNumber(int* const number) {
+  unsigned char bytes[4] = {0, 0, 0, 0};
+  int32_t value = 0;
 
-  while (true) {
-    const Opcode kOpcode = instructions[instruction_address++];
+  if (!ReadImage(bytes, sizeof(bytes))) {
+    return false;
+  }
 
-    switch (kOpcode) {
-      case kOpConstant: {
-        const size_t kIndex = instructions[instruction_address++];
+  value = (int32_t)((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+                    (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
 
-        StackValue stack_value = {};
-        stack_value.type = constants.type[kIndex];
+#ifdef __CC65__
+  if (INT_MIN > value || INT_MAX < value) {
+    return false;
+  }
+#endif
 
-        if (kConstantTypeString == constants.type[kIndex]) {
-          stack_value.as.string = (char*)constants.pointer[kIndex];
-        } else {
-          stack_value.as.number = *(const int*)constants.pointer[kIndex];
-        }
+  *number = (int)value;
 
-        Push(stack_value);
+  return true;
+}
 
-        break;
-      }
-      case kOpAdd: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+static bool WriteImageConstant(const size_t index) {
+  const char* const kText = (const char*)constants.pointer[index];
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+  if (!WriteImageByte((unsigned char)constants.type[index])) {
+    return false;
+  }
 
-        result.as.number =
-            stack_value_two.as.number + stack_value_one.as.number;
-        result.type = kConstantTypeNumber;
+  if (kConstantTypeString == constants.type[index]) {
+    return WriteImageWord(strlen(kText)) && WriteImage(kText, strlen(kText));
+  }
 
-        Push(result);
+  return WriteImageNumber(*(const int*)kText);
+}
 
-        break;
-      }
-      case kOpSubtract: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+/// Appends the next constant of the image to the pool and interns it, so code
+/// compiled after loading reuses it.
+static bool ReadImageConstant() {
+  unsigned char type = 0;
+  size_t length = 0;
+  size_t slot = 0;
+  char* text = &string_pool[string_pool_index];
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+  if (!ReadImage(&type, 1)) {
+    return false;
+  }
 
-        result.as.number =
-            stack_value_two.as.number - stack_value_one.as.number;
-        result.type = kConstantTypeNumber;
+  if (kConstantTypeString == type) {
+    if (!ReadImageWord(&length) ||
+        kStringPoolSize < string_pool_index + length + 1 ||
+        !ReadImage(text, length)) {
+      return false;
+    }
 
-        Push(result);
+    text[length] = '\0';
+    slot = FindStringSlot(text, length);
+    constants.pointer[constants_index] = text;
+    string_pool_index += length + 1;
+  } else if (kConstantTypeNumber == type || kConstantTypeBoolean == type) {
+    if (kNumberPoolSize <= number_pool_index ||
+        !ReadImageNumber(&number_pool[number_pool_index])) {
+      return false;
+    }
 
-        break;
-      }
-      case kOpMultiply: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+    slot = FindNumberSlot(number_pool[number_pool_index], type);
+    constants.pointer[constants_index] = &number_pool[number_pool_index];
+    ++number_pool_index;
+  } else {
+    return false;
+  }
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+  // Each value is stored once, a second copy means the image is broken.
+  if (0 != constant_table[slot]) {
+    return false;
+  }
 
-        result.as.number =
-            stack_value_two.as.number * stack_value_one.as.number;
-        result.type = kConstantTypeNumber;
+  constants.type[constants_index] = type;
+  constant_references[constants_index] = 1;
+  constant_table[slot] = constants_index + 1;
 
-        Push(result);
+  RaiseConstantsHighWaterMark();
 
-        break;
-      }
-      case kOpDivide: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+  ++constants_index;
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+  return true;
+}
 
-        if (0 == stack_value_one.as.number) {
-          puts("Error: Division by zero.");
+bool SaveImage(const char* const name) {
+  bool is_written = false;
+  size_t index = 0;
 
-          return;
-        }
+  if (!OpenImage(name, true)) {
+    puts("Error: Cannot open image.");
 
-        result.as.number =
-            stack_value_two.as.number / stack_value_one.as.number;
-        result.type = kConstantTypeNumber;
+    return false;
+  }
 
-        Push(result);
+  is_written = WriteImage(kImageMagic, sizeof(kImageMagic) - 1) &&
+               WriteImageByte(kImageVersion) &&
+               WriteImageByte((unsigned char)bytecode_format) &&
+               WriteImageWord(instruction_address) &&
+               WriteImageWord(register_instruction_address) &&
+               WriteImageWord(global_variable_index) &&
+               WriteImageWord(constants_index) &&
+               WriteImage(instructions, instruction_address) &&
+               WriteImage(register_instructions, register_instruction_address);
+
+  for (index = 0; is_written && index < constants_index; ++index) {
+    is_written = WriteImageConstant(index);
+  }
 
-        break;
-      }
-      case kOpModulo: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+  CloseImage();
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+  if (!is_written) {
+    puts("Error: Cannot write image.");
+  }
 
-        if (0 == stack_value_one.as.number) {
-          puts("Error: Division by zero.");
+  return is_written;
+}
 
-          return;
-        }
+bool LoadImage(const char* const name) {
+  unsigned char header[kImageHeaderSize];
+  size_t code_size = 0;
+  size_t register_code_size = 0;
+  size_t globals_count = 0;
+  size_t constants_count = 0;
+  bool is_read = false;
 
-        result.as.number =
-            stack_value_two.as.number % stack_value_one.as.number;
-        result.type = kConstantTypeNumber;
+  ResetInterpreterState();
 
-        Push(result);
+  if (!OpenImage(name, false)) {
+    puts("Error: Cannot open image.");
 
-        break;
-      }
-      case kOpEquals: {
-        StackValue stack_value_one = {};
+    return false;
+  }
+
+  is_read = ReadImage(header, kImageHeaderSize) &&
+            0 == memcmp(header, kImageMagic, sizeof(kImageMagic) - 1) &&
+            kImageVersion == header[kImageHeaderSize - 2] &&
+            (kBytecodeFormatNarrow == header[kImageHeaderSize - 1] ||
+             kBytecodeFormatWide == header[kImageHeaderSize - 1]) &&
+            ReadImageWord(&code_size) && ReadImageWord(&register_code_size) &&
+            ReadImageWord(&globals_count) && ReadImageWord(&constants_count);
+
+  if (is_read && (kInstructionsSize < code_size ||
+                  kRegisterInstructionsSize < register_code_size ||
+                  kGlobalVariablesSize < globals_count ||
+                  kConstantsSize < constants_count)) {
+    puts("Error: Image too large.");
+
+    CloseImage();
+
+    return false;
+  }
+
+  // The sizes are set before the buffers are filled, so that the reset after
+  // a failed load clears whatever was read.
+  if (is_read) {
+    instruction_address = code_size;
+    register_instruction_address = register_code_size;
+    global_variable_index = globals_count;
+
+    is_read = ReadImage(instructions, code_size) &&
+              ReadImage(register_instructions, register_code_size);
+  }
+
+  while (is_read && constants_index < constants_count) {
+    is_read = ReadImageConstant();
+  }
+
+  CloseImage();
+
+  if (!is_read) {
+    puts("Error: Invalid image.");
+
+    ResetInterpreterState();
+
+    return false;
+  }
+
+  bytecode_format = (BytecodeFormat)header[kImageHeaderSize - 1];
+
+  return true;
+}
+
+/// Opens a frame whose locals are the `arity` arguments on top of the stack.
+/// Returns false if the call stack is full.
+static bool PushCallFrame(const size_t arity, const size_t return_address) {
+  if (kCallFrameTableSize <= call_frame_index) {
+    puts("Error: Call stack overflow.");
+
+    return false;
+  }
+
+  call_frames.return_address[call_frame_index] = return_address;
+  call_frames.arity[call_frame_index] = arity;
+  call_frames.stack_offset[call_frame_index] = stack_index - arity;
+
+  ++call_frame_index;
+
+  return true;
+}
+
+/// Replaces the locals of the current frame with the `arity` arguments on top
+/// of the stack. The return address stays, so the callee returns straight to
+/// the caller of the current function.
+static void ReuseCallFrame(const size_t arity) {
+  const size_t kStackOffset = call_frames.stack_offset[call_frame_index - 1];
+
+  memmove(&stack[kStackOffset], &stack[stack_index - arity],
+          arity * sizeof(StackValue));
+
+  call_frames.arity[call_frame_index - 1] = arity;
+  stack_index = kStackOffset + arity;
+}
+
+static size_t PopCallFrame(const StackValue* const stack_value) {
+  --call_frame_index;
+
+  stack_index = call_frames.stack_offset[call_frame_index];
+
+  Push(*stack_value);
+
+  return call_frames.return_address[call_frame_index];
+}
+
+/// Evaluates one of the comparison opcodes kOpEquals to kOpLessThanOrEqualTo.
+static bool Compare(const Opcode comparison, const int left, const int right) {
+  switch (comparison) {
+    case kOpEquals:
+      return left == right;
+    case kOpNotEquals:
+      return left != right;
+    case kOpGreaterThan:
+      return left > right;
+    case kOpGreaterThanOrEqualTo:
+      return left >= right;
+    case kOpLessThan:
+      return left < right;
+    default:
+      return left <= right;
+  }
+}
+
+static void PrintStackValue(const StackValue* const stack_value) {
+#if defined(__CC65__) && !defined(NDEBUG)
+  StartSection(kSectionPrint);
+#endif
+
+  switch (stack_value->type) {
+    case kConstantTypeString:
+      printf("%s\n", stack_value->as.string);
+
+      break;
+    case kConstantTypeNumber:
+      printf("%d\n", stack_value->as.number);
+
+      break;
+    case kConstantTypeBoolean:
+      printf("%s\n", stack_value->as.number ? "true" : "false");
+
+      break;
+    default:
+      puts("Error: Unknown print type.");
+
+      break;
+  }
+
+#if defined(__CC65__) && !defined(NDEBUG)
+  StopSection(kSectionPrint);
+#endif
+}
+
+void PrintOpcodes() {
+#ifdef __CC65__
+  static const size_t kRowLength = 8;
+#else
+  static constexpr size_t kRowLength = 8;
+#endif
+
+  size_t index = 0;
+
+  if (0 == instruction_address) {
+    puts("No opcodes.");
+
+    return;
+  }
+
+  for (index = 0; index < instruction_address; ++index) {
+    if (0 != index && 0 == index % kRowLength) {
+      puts("");
+    }
+
+    if (0 != index && 0 != index % kRowLength) {
+      putchar(' ');
+    }
+
+    printf("%d", instructions[index]);
+  }
+
+  puts("");
+}
+
+unsigned long ReadTicks() {
+#ifdef __CC65__
+  return ReadTimer();
+#else
+  struct timespec now = {};
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((unsigned long)now.tv_sec * kNanosecondsPerSecond) +
+         (unsigned long)now.tv_nsec;
+#endif
+}
+
+#ifdef VM_PROFILE
+/// Opcode names for the profile, without their "kOp" prefix.
+static const char* const kOpcodeNames[kOpcodeCount] = {
+    "Constant", "Add", "Subtract", "Multiply", "Divide", "Modulo", "Equals",
+    "NotEquals", "GreaterThan", "GreaterThanOrEqualTo", "LessThan",
+    "LessThanOrEqualTo", "Print", "JumpIfFalse", "Jump", "Halt", "StoreGlobal",
+    "LoadGlobal", "StoreLocal", "LoadLocal", "DefineFunction", "CallFunction",
+    "Return", "PushCallFrame", "PopCallFrame", "MakeArray", "IndexArray",
+    "StoreElement", "LoadGlobalAddConst", "IncGlobal", "CompareGlobalConstJump",
+    "ConstantWide", "JumpIfFalseWide", "JumpWide", "StoreGlobalWide",
+    "LoadGlobalWide", "DefineFunctionWide", "AddInt", "SubtractInt",
+    "MultiplyInt", "DivideInt", "ModuloInt", "EqualsInt", "NotEqualsInt",
+    "GreaterThanInt", "GreaterThanOrEqualToInt", "LessThanInt",
+    "LessThanOrEqualToInt", "JumpIfFalseBool", "JumpIfFalseBoolWide",
+    "CallDirect", "CallDirectWide", "TailCallDirect", "TailCallDirectWide",
+    "PushSmallInt", "PushInt16", "PushTrue", "PushFalse",
+};
+
+static void CountOpcodePair(const size_t key) {
+  size_t slot = key & (kProfilePairsSize - 1);
+  size_t probe = 0;
+
+  for (probe = 0; probe < kProfilePairsSize; ++probe) {
+    if (0 == pair_counts[slot] || key == pair_keys[slot]) {
+      pair_keys[slot] = (unsigned short)key;
+      ++pair_counts[slot];
+
+      return;
+    }
+
+    slot = (slot + 1) & (kProfilePairsSize - 1);
+  }
+
+  ++dropped_pairs;
+}
+
+/// Charges the time since the previous call to the opcode that ran, and
+/// starts timing `opcode`. kOpcodeCount stops the profile.
+static void ProfileOpcode(const unsigned char opcode) {
+  if (kOpcodeCount > profiled_opcode) {
+    opcode_ticks[profiled_opcode] += ReadTicks() - profile_clock;
+
+    if (kOpcodeCount > opcode) {
+      CountOpcodePair(((size_t)profiled_opcode * kOpcodeCount) + opcode);
+    }
+  }
+
+  if (kOpcodeCount > opcode) {
+    ++opcode_counts[opcode];
+  }
+
+  profiled_opcode = opcode;
+  // Read again, so the bookkeeping above isn't charged to `opcode`.
+  profile_clock = ReadTicks();
+}
+
+/// Returns the index of the largest of `size` counts.
+static size_t FindLargestCount(const unsigned long* const counts,
+                               const size_t size) {
+  size_t index = 0;
+  size_t largest = 0;
+
+  for (index = 1; index < size; ++index) {
+    if (counts[largest] < counts[index]) {
+      largest = index;
+    }
+  }
+
+  return largest;
+}
+#endif
+
+void PrintProfile() {
+#ifdef VM_PROFILE
+  size_t largest = FindLargestCount(opcode_counts, kOpcodeCount);
+  size_t pair = 0;
+
+  if (0 == opcode_counts[largest]) {
+    puts("No profile.");
+
+    return;
+  }
+
+  printf("%-23s %8s %10s\n", "Opcode", "Count", "Ticks");
+
+  // Printed counts are cleared, which leaves the next largest one.
+  while (0 != opcode_counts[largest]) {
+    printf("%-23s %8lu %10lu\n", kOpcodeNames[largest],
+           opcode_counts[largest], opcode_ticks[largest]);
+
+    opcode_counts[largest] = 0;
+    largest = FindLargestCount(opcode_counts, kOpcodeCount);
+  }
+
+  puts("Opcode pairs:");
+
+  for (pair = 0; pair < kProfileReportPairs; ++pair) {
+    largest = FindLargestCount(pair_counts, kProfilePairsSize);
+
+    if (0 == pair_counts[largest]) {
+      break;
+    }
+
+    printf("%s %s %lu\n", kOpcodeNames[pair_keys[largest] / kOpcodeCount],
+           kOpcodeNames[pair_keys[largest] % kOpcodeCount],
+           pair_counts[largest]);
+
+    pair_counts[largest] = 0;
+  }
+
+  if (0 != dropped_pairs) {
+    printf("%lu pairs not counted.\n", dropped_pairs);
+  }
+
+  // NOLINTBEGIN(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memset(opcode_ticks, 0, sizeof(opcode_ticks));
+  memset(pair_counts, 0, sizeof(pair_counts));
+  // NOLINTEND(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+
+  dropped_pairs = 0;
+#else
+  puts("Error: Built without VM_PROFILE.");
+#endif
+}
+
+#ifdef VM_DIRECT_THREADING
+/// Translates the code from `index` on. The code in front of it was
+/// translated by an earlier run.
+static void TranslateInstructions(const void* const* const dispatch_table,
+                                  size_t index) {
+  size_t operand_index = 0;
+
+  while (index < instruction_address) {
+    const unsigned char kOpcode = instructions[index];
+
+    threaded_code[index].handler = dispatch_table[kOpcode];
+
+    if (kOpcodeCount <= kOpcode) {
+      ++index;
+
+      continue;
+    }
+
+    for (operand_index = 1;
+         operand_index <= kOperandCount[kOpcode] &&
+         index + operand_index < instruction_address;
+         ++operand_index) {
+      threaded_code[index + operand_index].operand =
+          instructions[index + operand_index];
+    }
+
+    index += operand_index;
+  }
+}
+#endif
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#pragma clang diagnostic ignored "-Wgnu-designator"
+#pragma clang diagnostic ignored "-Winitializer-overrides"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+// NOLINTNEXTLINE(readability-function-cognitive-complexity)
+static void RunStackVmFrom(const size_t start_address) {
+#ifdef VM_THREADED_DISPATCH
+  static const void* const kDispatchTable[kDispatchTableSize] = {
+      [0 ... kDispatchTableSize - 1] = &&VmUndefinedHandler,
+      [kOpConstant] = &&kOpConstantHandler,
+      [kOpAdd] = &&kOpAddHandler,
+      [kOpSubtract] = &&kOpSubtractHandler,
+      [kOpMultiply] = &&kOpMultiplyHandler,
+      [kOpDivide] = &&kOpDivideHandler,
+      [kOpModulo] = &&kOpModuloHandler,
+      [kOpEquals] = &&kOpEqualsHandler,
+      [kOpNotEquals] = &&kOpNotEqualsHandler,
+      [kOpGreaterThan] = &&kOpGreaterThanHandler,
+      [kOpGreaterThanOrEqualTo] = &&kOpGreaterThanOrEqualToHandler,
+      [kOpLessThan] = &&kOpLessThanHandler,
+      [kOpLessThanOrEqualTo] = &&kOpLessThanOrEqualToHandler,
+      [kOpPrint] = &&kOpPrintHandler,
+      [kOpJumpIfFalse] = &&kOpJumpIfFalseHandler,
+      [kOpJump] = &&kOpJumpHandler,
+      [kOpHalt] = &&kOpHaltHandler,
+      [kOpStoreGlobal] = &&kOpStoreGlobalHandler,
+      [kOpLoadGlobal] = &&kOpLoadGlobalHandler,
+      [kOpStoreLocal] = &&kOpStoreLocalHandler,
+      [kOpLoadLocal] = &&kOpLoadLocalHandler,
+      [kOpDefineFunction] = &&kOpDefineFunctionHandler,
+      [kOpCallFunction] = &&kOpCallFunctionHandler,
+      [kOpReturn] = &&kOpReturnHandler,
+      [kOpPushCallFrame] = &&kOpPushCallFrameHandler,
+      [kOpPopCallFrame] = &&kOpPopCallFrameHandler,
+      [kOpMakeArray] = &&kOpMakeArrayHandler,
+      [kOpIndexArray] = &&kOpIndexArrayHandler,
+      [kOpStoreElement] = &&kOpStoreElementHandler,
+      [kOpLoadGlobalAddConst] = &&kOpLoadGlobalAddConstHandler,
+      [kOpIncGlobal] = &&kOpIncGlobalHandler,
+      [kOpCompareGlobalConstJump] = &&kOpCompareGlobalConstJumpHandler,
+      [kOpConstantWide] = &&kOpConstantWideHandler,
+      [kOpJumpIfFalseWide] = &&kOpJumpIfFalseWideHandler,
+      [kOpJumpWide] = &&kOpJumpWideHandler,
+      [kOpStoreGlobalWide] = &&kOpStoreGlobalWideHandler,
+      [kOpLoadGlobalWide] = &&kOpLoadGlobalWideHandler,
+      [kOpDefineFunctionWide] = &&kOpDefineFunctionWideHandler,
+      [kOpAddInt] = &&kOpAddIntHandler,
+      [kOpSubtractInt] = &&kOpSubtractIntHandler,
+      [kOpMultiplyInt] = &&kOpMultiplyIntHandler,
+      [kOpDivideInt] = &&kOpDivideIntHandler,
+      [kOpModuloInt] = &&kOpModuloIntHandler,
+      [kOpEqualsInt] = &&kOpEqualsIntHandler,
+      [kOpNotEqualsInt] = &&kOpNotEqualsIntHandler,
+      [kOpGreaterThanInt] = &&kOpGreaterThanIntHandler,
+      [kOpGreaterThanOrEqualToInt] = &&kOpGreaterThanOrEqualToIntHandler,
+      [kOpLessThanInt] = &&kOpLessThanIntHandler,
+      [kOpLessThanOrEqualToInt] = &&kOpLessThanOrEqualToIntHandler,
+      [kOpJumpIfFalseBool] = &&kOpJumpIfFalseBoolHandler,
+      [kOpJumpIfFalseBoolWide] = &&kOpJumpIfFalseBoolWideHandler,
+      [kOpCallDirect] = &&kOpCallDirectHandler,
+      [kOpCallDirectWide] = &&kOpCallDirectWideHandler,
+      [kOpTailCallDirect] = &&kOpTailCallDirectHandler,
+      [kOpTailCallDirectWide] = &&kOpTailCallDirectWideHandler,
+      [kOpPushSmallInt] = &&kOpPushSmallIntHandler,
+      [kOpPushInt16] = &&kOpPushInt16Handler,
+      [kOpPushTrue] = &&kOpPushTrueHandler,
+      [kOpPushFalse] = &&kOpPushFalseHandler,
+  };
+#endif
+
+  size_t program_counter = start_address;
+
+  stack_index = 0;
+  call_frame_index = 0;
+
+#ifdef VM_DIRECT_THREADING
+  TranslateInstructions(kDispatchTable, start_address);
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+  VmDispatch();
+#else
+  while (true) {
+    const Opcode kOpcode = instructions[program_counter++];
+
+#ifdef VM_PROFILE
+    ProfileOpcode(kOpcode);
+#endif
+
+    switch (kOpcode) {
+#endif
+      VmCase(kOpConstant): {
+        const size_t kIndex = VmReadOperand();
+
+        StackValue stack_value = {};
+        stack_value.type = constants.type[kIndex];
+
+        if (kConstantTypeString == constants.type[kIndex]) {
+          stack_value.as.string = (char*)constants.pointer[kIndex];
+        } else {
+          stack_value.as.number = *(const int*)constants.pointer[kIndex];
+        }
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpPushSmallInt): {
+        StackValue stack_value = {};
+        stack_value.type = kConstantTypeNumber;
+        stack_value.as.number = (int)VmReadOperand();
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpPushInt16): {
+        StackValue stack_value = {};
+        stack_value.type = kConstantTypeNumber;
+        stack_value.as.number = (short)VmReadWideOperand();
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpPushTrue): {
+        StackValue stack_value = {};
+        stack_value.type = kConstantTypeBoolean;
+        stack_value.as.number = 1;
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpPushFalse): {
+        StackValue stack_value = {};
+        stack_value.type = kConstantTypeBoolean;
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpAdd): {
+        StackValue stack_value_one = {};
         StackValue stack_value_two = {};
         StackValue result = {};
 
@@ -394,369 +1294,1167 @@ void RunVm() {
         // cppcheck-suppress-end redundantInitialization
 
         result.as.number =
-            stack_value_two.as.number == stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+            stack_value_two.as.number + stack_value_one.as.number;
+        result.type = kConstantTypeNumber;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpSubtract): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number - stack_value_one.as.number;
+        result.type = kConstantTypeNumber;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpMultiply): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number * stack_value_one.as.number;
+        result.type = kConstantTypeNumber;
 
         Push(result);
 
-        break;
+        VmDispatch();
+      }
+      VmCase(kOpDivide): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        if (0 == stack_value_one.as.number) {
+          puts("Error: Division by zero.");
+
+          return;
+        }
+
+        result.as.number =
+            stack_value_two.as.number / stack_value_one.as.number;
+        result.type = kConstantTypeNumber;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpModulo): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        if (0 == stack_value_one.as.number) {
+          puts("Error: Division by zero.");
+
+          return;
+        }
+
+        result.as.number =
+            stack_value_two.as.number % stack_value_one.as.number;
+        result.type = kConstantTypeNumber;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpEquals): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number == stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpNotEquals): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number != stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpGreaterThan): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number > stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpGreaterThanOrEqualTo): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number >= stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpLessThan): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number < stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpLessThanOrEqualTo): {
+        StackValue stack_value_one = {};
+        StackValue stack_value_two = {};
+        StackValue result = {};
+
+        // cppcheck-suppress-begin redundantInitialization
+        stack_value_one = Pop();
+        stack_value_two = Pop();
+        // cppcheck-suppress-end redundantInitialization
+
+        result.as.number =
+            stack_value_two.as.number <= stack_value_one.as.number;
+        result.type = kConstantTypeBoolean;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpPrint): {
+        StackValue stack_value = {};
+
+        // cppcheck-suppress redundantInitialization
+        stack_value = Pop();
+
+        PrintStackValue(&stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpJumpIfFalse): {
+        const size_t kJumpAddress = VmReadOperand();
+        StackValue stack_value = {};
+
+        // cppcheck-suppress redundantInitialization
+        stack_value = Pop();
+
+        if (kConstantTypeBoolean == stack_value.type &&
+            0 == stack_value.as.number) {
+          program_counter = kJumpAddress;
+        }
+
+        VmDispatch();
+      }
+      VmCase(kOpJump): {
+        const size_t kJumpAddress = VmReadOperand();
+
+        program_counter = kJumpAddress;
+
+        VmDispatch();
+      }
+      VmCase(kOpStoreGlobal): {
+        const size_t kIndex = VmReadOperand();
+
+        // TODO(Martin): Implement type checker.
+        // cppcheck-suppress unreadVariable
+        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
+        const VariableType kVariableType = VmReadOperand();
+
+        StackValue global_variable = {};
+
+        // cppcheck-suppress redundantInitialization
+        global_variable = Pop();
+
+        global_variables[kIndex] = global_variable;
+
+        VmDispatch();
+      }
+      VmCase(kOpLoadGlobal): {
+        const size_t kIndex = VmReadOperand();
+
+        // TODO(Martin): Implement type checker.
+        // cppcheck-suppress unreadVariable
+        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
+        const VariableType kVariableType = VmReadOperand();
+
+        StackValue global_variable = {};
+
+        // cppcheck-suppress redundantInitialization
+        global_variable = global_variables[kIndex];
+
+        Push(global_variable);
+
+        VmDispatch();
+      }
+      VmCase(kOpStoreLocal): {
+        const size_t kIndex = VmReadOperand();
+
+        // TODO(Martin): Implement type checker.
+        // cppcheck-suppress unreadVariable
+        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
+        const VariableType kVariableType = VmReadOperand();
+
+        const size_t kStackOffset =
+            call_frames.stack_offset[call_frame_index - 1];
+
+        stack[kStackOffset + kIndex] = Pop();
+
+        VmDispatch();
+      }
+      VmCase(kOpLoadLocal): {
+        const size_t kIndex = VmReadOperand();
+
+        // TODO(Martin): Implement type checker.
+        // cppcheck-suppress unreadVariable
+        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
+        const VariableType kVariableType = VmReadOperand();
+
+        const size_t kStackOffset =
+            call_frames.stack_offset[call_frame_index - 1];
+
+        Push(stack[kStackOffset + kIndex]);
+
+        VmDispatch();
+      }
+      VmCase(kOpDefineFunction): {
+        const size_t kIndex = VmReadOperand();
+        const size_t kBodyStartIndex = VmReadOperand();
+        const size_t kArity = VmReadOperand();
+        const VariableType kReturnType = VmReadOperand();
+
+        StackValue global_variable = {};
+
+        Function* function = &function_pool[function_pool_index];
+
+        // Definitions run again in loops, so the parser can't rule this out.
+        if (kFunctionPoolSize <= function_pool_index) {
+          puts("Error: Too many functions.");
+
+          return;
+        }
+
+        function->body_start_index = kBodyStartIndex;
+        function->arity = kArity;
+        function->return_type = kReturnType;
+
+        ++function_pool_index;
+
+        global_variable.type = kConstantTypeFunction;
+        global_variable.as.function = function;
+
+        global_variables[kIndex] = global_variable;
+
+        VmDispatch();
+      }
+      VmCase(kOpCallFunction): {
+        const size_t kArity = VmReadOperand();
+        const size_t kFunctionIndex = stack_index - kArity - 1;
+        const Function* const kFunction = stack[kFunctionIndex].as.function;
+
+        // Move the arguments over the function value, so the frame looks the
+        // same as one opened by kOpCallDirect.
+        memmove(&stack[kFunctionIndex], &stack[kFunctionIndex + 1],
+                kArity * sizeof(StackValue));
+        --stack_index;
+
+        if (!PushCallFrame(kArity, program_counter)) {
+          return;
+        }
+
+        program_counter = kFunction->body_start_index;
+
+        VmDispatch();
+      }
+      VmCase(kOpReturn): {
+        StackValue stack_value = {};
+
+        // cppcheck-suppress redundantInitialization
+        stack_value = Pop();
+
+        program_counter = PopCallFrame(&stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpPushCallFrame): {
+        program_counter += 2;
+
+        VmDispatch();
+      }
+      VmCase(kOpPopCallFrame): {
+        VmDispatch();
+      }
+      VmCase(kOpMakeArray): {
+        const size_t kElementCount = VmReadOperand();
+        StackValue val;
+        size_t element = 0;
+        Array* array_instance = &array_pool[array_pool_index++];
+        StackValue array_value = {0};
+        array_value.type = kVariableTypeArray;
+        array_value.as.array = array_instance;
+
+        if (kElementCount > kArrayElementsMax) {
+          puts("Error: Array too large.");
+          return;
+        }
+
+        if (array_pool_index >= kArrayPoolSize) {
+          puts("Error: Too many arrays.");
+          return;
+        }
+
+        for (element = 0; element < kElementCount; ++element) {
+          val = Pop();
+          if (val.type != kVariableTypeInt) {
+            puts("Error: Only integer are supported in arrays.");
+            return;
+          }
+          array_instance->elements[kElementCount - element - 1] = val.as.number;
+        }
+        array_instance->count = kElementCount;
+
+        Push(array_value);
+        VmDispatch();
+      }
+      VmCase(kOpIndexArray): {
+        StackValue index;
+        StackValue array;
+        StackValue result;
+
+        index = Pop();
+        array = Pop();
+        if (array.type != kVariableTypeArray) {
+          puts("Runtime error: Cannot index non-array.");
+          return;
+        }
+
+        if (index.type != kVariableTypeInt) {
+          puts("Runtime error: Array index must be integer.");
+          return;
+        }
+
+        if (index.as.number < 0 ||
+            (size_t)index.as.number >= array.as.array->count) {
+          puts("Runtime error: Array index out of bounds.");
+          return;
+        }
+        result.type = kVariableTypeInt;
+        result.as.number = array.as.array->elements[index.as.number];
+
+        Push(result);
+        VmDispatch();
+      }
+      VmCase(kOpStoreElement): {
+        const size_t kArrayIndex = VmReadOperand();
+        StackValue value;
+        StackValue index;
+        StackValue array;
+
+        value = Pop();
+        index = Pop();
+        array = global_variables[kArrayIndex];
+
+        if (array.type != kVariableTypeArray || !array.as.array) {
+          puts("Runtime error: This is not an array.");
+          return;
+        }
+
+        if (index.type != kVariableTypeInt) {
+          puts("Runtime error: Array index must be integer.");
+          return;
+        }
+
+        if (value.type != kVariableTypeInt) {
+          puts("Runtime error: Only integers can be stored in arrays.");
+          return;
+        }
+
+        if (index.as.number < 0 ||
+            (size_t)index.as.number >= array.as.array->count) {
+          puts("Runtime error: Array index out of bounds.");
+          return;
+        }
+
+        array.as.array->elements[index.as.number] = value.as.number;
+        VmDispatch();
+      }
+      VmCase(kOpLoadGlobalAddConst): {
+        const size_t kIndex = VmReadOperand();
+        const int kValue = (int)VmReadOperand();
+        StackValue result = {};
+
+        result.as.number = global_variables[kIndex].as.number + kValue;
+        result.type = kConstantTypeNumber;
+
+        Push(result);
+
+        VmDispatch();
+      }
+      VmCase(kOpIncGlobal): {
+        const size_t kIndex = VmReadOperand();
+        const int kValue = (int)VmReadOperand();
+
+        global_variables[kIndex].as.number += kValue;
+
+        VmDispatch();
+      }
+      VmCase(kOpCompareGlobalConstJump): {
+        const size_t kIndex = VmReadOperand();
+        const int kValue = (int)VmReadOperand();
+        const Opcode kComparison = VmReadOperand();
+        const size_t kJumpAddress = VmReadOperand();
+
+        if (!Compare(kComparison, global_variables[kIndex].as.number,
+                     kValue)) {
+          program_counter = kJumpAddress;
+        }
+
+        VmDispatch();
+      }
+      VmCase(kOpConstantWide): {
+        const size_t kIndex = VmReadWideOperand();
+
+        StackValue stack_value = {};
+        stack_value.type = (VariableType)constants.type[kIndex];
+
+        if (kConstantTypeString == constants.type[kIndex]) {
+          stack_value.as.string = (char*)constants.pointer[kIndex];
+        } else {
+          stack_value.as.number = *(const int*)constants.pointer[kIndex];
+        }
+
+        Push(stack_value);
+
+        VmDispatch();
+      }
+      VmCase(kOpJumpIfFalseWide): {
+        const size_t kJumpAddress = VmReadWideOperand();
+        StackValue stack_value = {};
+
+        // cppcheck-suppress redundantInitialization
+        stack_value = Pop();
+
+        if ((VariableType)kConstantTypeBoolean == stack_value.type &&
+            0 == stack_value.as.number) {
+          program_counter = kJumpAddress;
+        }
+
+        VmDispatch();
+      }
+      VmCase(kOpJumpWide): {
+        const size_t kJumpAddress = VmReadWideOperand();
+
+        program_counter = kJumpAddress;
+
+        VmDispatch();
+      }
+      VmCase(kOpStoreGlobalWide): {
+        const size_t kIndex = VmReadWideOperand();
+
+        // TODO(Martin): Implement type checker.
+        ++program_counter;
+
+        global_variables[kIndex] = Pop();
+
+        VmDispatch();
+      }
+      VmCase(kOpLoadGlobalWide): {
+        const size_t kIndex = VmReadWideOperand();
+
+        // TODO(Martin): Implement type checker.
+        ++program_counter;
+
+        Push(global_variables[kIndex]);
+
+        VmDispatch();
+      }
+      VmCase(kOpDefineFunctionWide): {
+        const size_t kIndex = VmReadWideOperand();
+        const size_t kBodyStartIndex = VmReadWideOperand();
+        const size_t kArity = VmReadOperand();
+        const VariableType kReturnType = (VariableType)VmReadOperand();
+
+        StackValue global_variable = {};
+
+        Function* function = &function_pool[function_pool_index];
+
+        // Definitions run again in loops, so the parser can't rule this out.
+        if (kFunctionPoolSize <= function_pool_index) {
+          puts("Error: Too many functions.");
+
+          return;
+        }
+
+        function->body_start_index = kBodyStartIndex;
+        function->arity = kArity;
+        function->return_type = kReturnType;
+
+        ++function_pool_index;
+
+        global_variable.type = (VariableType)kConstantTypeFunction;
+        global_variable.as.function = function;
+
+        global_variables[kIndex] = global_variable;
+
+        VmDispatch();
+      }
+      // The parser only emits the *Int opcodes for operands it has proven to
+      // be integers. They work in place on the left operand, whose slot
+      // already has the number tag, and skip the stack bounds checks.
+      VmCase(kOpAddInt): {
+        --stack_index;
+        stack[stack_index - 1].as.number += stack[stack_index].as.number;
+
+        VmDispatch();
+      }
+      VmCase(kOpSubtractInt): {
+        --stack_index;
+        stack[stack_index - 1].as.number -= stack[stack_index].as.number;
+
+        VmDispatch();
+      }
+      VmCase(kOpMultiplyInt): {
+        --stack_index;
+        stack[stack_index - 1].as.number *= stack[stack_index].as.number;
+
+        VmDispatch();
+      }
+      VmCase(kOpDivideInt): {
+        --stack_index;
+
+        if (0 == stack[stack_index].as.number) {
+          puts("Error: Division by zero.");
+
+          return;
+        }
+
+        stack[stack_index - 1].as.number /= stack[stack_index].as.number;
+
+        VmDispatch();
+      }
+      VmCase(kOpModuloInt): {
+        --stack_index;
+
+        if (0 == stack[stack_index].as.number) {
+          puts("Error: Division by zero.");
+
+          return;
+        }
+
+        stack[stack_index - 1].as.number %= stack[stack_index].as.number;
+
+        VmDispatch();
+      }
+      // Comparisons still tag their result, since it is stored and printed as a
+      // boolean.
+      VmCase(kOpEqualsInt): {
+        --stack_index;
+
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number == stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
+
+        VmDispatch();
+      }
+      VmCase(kOpNotEqualsInt): {
+        --stack_index;
+
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number != stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
+
+        VmDispatch();
+      }
+      VmCase(kOpGreaterThanInt): {
+        --stack_index;
+
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number > stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
+
+        VmDispatch();
       }
-      case kOpNotEquals: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+      VmCase(kOpGreaterThanOrEqualToInt): {
+        --stack_index;
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number >= stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
 
-        result.as.number =
-            stack_value_two.as.number != stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+        VmDispatch();
+      }
+      VmCase(kOpLessThanInt): {
+        --stack_index;
 
-        Push(result);
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number < stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
 
-        break;
+        VmDispatch();
       }
-      case kOpGreaterThan: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+      VmCase(kOpLessThanOrEqualToInt): {
+        --stack_index;
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+        stack[stack_index - 1].as.number =
+            stack[stack_index - 1].as.number <= stack[stack_index].as.number;
+        stack[stack_index - 1].type = kConstantTypeBoolean;
 
-        result.as.number =
-            stack_value_two.as.number > stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+        VmDispatch();
+      }
+      VmCase(kOpJumpIfFalseBool): {
+        const size_t kJumpAddress = VmReadOperand();
 
-        Push(result);
+        if (0 == stack[--stack_index].as.number) {
+          program_counter = kJumpAddress;
+        }
 
-        break;
+        VmDispatch();
       }
-      case kOpGreaterThanOrEqualTo: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+      VmCase(kOpJumpIfFalseBoolWide): {
+        const size_t kJumpAddress = VmReadWideOperand();
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+        if (0 == stack[--stack_index].as.number) {
+          program_counter = kJumpAddress;
+        }
 
-        result.as.number =
-            stack_value_two.as.number >= stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+        VmDispatch();
+      }
+      // Calls to a function the parser has already seen carry its body
+      // address and arity, so no function value is loaded or dereferenced.
+      VmCase(kOpCallDirect): {
+        const size_t kBodyStartIndex = VmReadOperand();
+        const size_t kArity = VmReadOperand();
 
-        Push(result);
+        if (!PushCallFrame(kArity, program_counter)) {
+          return;
+        }
 
-        break;
+        program_counter = kBodyStartIndex;
+
+        VmDispatch();
       }
-      case kOpLessThan: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+      VmCase(kOpCallDirectWide): {
+        const size_t kBodyStartIndex = VmReadWideOperand();
+        const size_t kArity = VmReadOperand();
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+        if (!PushCallFrame(kArity, program_counter)) {
+          return;
+        }
 
-        result.as.number =
-            stack_value_two.as.number < stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+        program_counter = kBodyStartIndex;
 
-        Push(result);
+        VmDispatch();
+      }
+      // A direct call in tail position takes over the frame of the function
+      // that makes it, so tail recursion runs in constant stack space.
+      VmCase(kOpTailCallDirect): {
+        const size_t kBodyStartIndex = VmReadOperand();
+        const size_t kArity = VmReadOperand();
+
+        ReuseCallFrame(kArity);
 
-        break;
+        program_counter = kBodyStartIndex;
+
+        VmDispatch();
       }
-      case kOpLessThanOrEqualTo: {
-        StackValue stack_value_one = {};
-        StackValue stack_value_two = {};
-        StackValue result = {};
+      VmCase(kOpTailCallDirectWide): {
+        const size_t kBodyStartIndex = VmReadWideOperand();
+        const size_t kArity = VmReadOperand();
 
-        // cppcheck-suppress-begin redundantInitialization
-        stack_value_one = Pop();
-        stack_value_two = Pop();
-        // cppcheck-suppress-end redundantInitialization
+        ReuseCallFrame(kArity);
 
-        result.as.number =
-            stack_value_two.as.number <= stack_value_one.as.number;
-        result.type = kConstantTypeBoolean;
+        program_counter = kBodyStartIndex;
 
-        Push(result);
+        VmDispatch();
+      }
+      VmCase(kOpHalt): {
+        return;
+      }
+      VmDefault: {
+        printf("Error: Undefined opcode '%d'.\n",
+               instructions[program_counter - 1]);
 
-        break;
+        return;
       }
-      case kOpPrint: {
-        StackValue stack_value = {};
+#ifndef VM_THREADED_DISPATCH
+    }
+  }
+#endif
+}
 
-        // cppcheck-suppress redundantInitialization
-        stack_value = Pop();
+void RunVmFrom(const size_t start_address) {
+#ifdef VM_PROFILE
+  profiled_opcode = kOpcodeCount;
+#endif
 
-        switch (stack_value.type) {
-          case kConstantTypeString:
-            printf("%s\n", stack_value.as.string);
+  RunStackVmFrom(start_address);
 
-            break;
-          case kConstantTypeNumber:
-            printf("%d\n", stack_value.as.number);
+#ifdef VM_PROFILE
+  ProfileOpcode(kOpcodeCount);
+#endif
+}
 
-            break;
-          case kConstantTypeBoolean:
-            printf("%s\n", stack_value.as.number ? "true" : "false");
+void RunVm() {
+  function_pool_index = 0;
+  array_pool_index = 0;
 
-            break;
-          default:
-            puts("Error: Unknown print type.");
+  RunVmFrom(0);
+}
 
-            break;
-        }
+static void LoadConstantRegisters() {
+  size_t index = 0;
 
-        break;
-      }
-      case kOpJumpIfFalse: {
-        const size_t kJumpAddress = instructions[instruction_address++];
-        StackValue stack_value = {};
+  for (index = 0;
+       index < 2 * kRegisterBankSize && index < kConstantsSize &&
+       constants.pointer[index];
+       ++index) {
+    constant_registers[index].type = constants.type[index];
+
+    if (kConstantTypeString == constants.type[index]) {
+      constant_registers[index].as.string = (char*)constants.pointer[index];
+    } else {
+      constant_registers[index].as.number =
+          *(const int*)constants.pointer[index];
+    }
+  }
+}
 
-        // cppcheck-suppress redundantInitialization
-        stack_value = Pop();
+// NOLINTNEXTLINE(readability-function-cognitive-complexity)
+void RunRegisterVm() {
+#ifdef VM_THREADED_DISPATCH
+  static const void* const kDispatchTable[kDispatchTableSize] = {
+      [0 ... kDispatchTableSize - 1] = &&VmUndefinedHandler,
+      [kRegisterOpEnter] = &&kRegisterOpEnterHandler,
+      [kRegisterOpMove] = &&kRegisterOpMoveHandler,
+      [kRegisterOpAdd] = &&kRegisterOpAddHandler,
+      [kRegisterOpSubtract] = &&kRegisterOpSubtractHandler,
+      [kRegisterOpMultiply] = &&kRegisterOpMultiplyHandler,
+      [kRegisterOpDivide] = &&kRegisterOpDivideHandler,
+      [kRegisterOpModulo] = &&kRegisterOpModuloHandler,
+      [kRegisterOpEquals] = &&kRegisterOpEqualsHandler,
+      [kRegisterOpNotEquals] = &&kRegisterOpNotEqualsHandler,
+      [kRegisterOpGreaterThan] = &&kRegisterOpGreaterThanHandler,
+      [kRegisterOpGreaterThanOrEqualTo] =
+          &&kRegisterOpGreaterThanOrEqualToHandler,
+      [kRegisterOpLessThan] = &&kRegisterOpLessThanHandler,
+      [kRegisterOpLessThanOrEqualTo] = &&kRegisterOpLessThanOrEqualToHandler,
+      [kRegisterOpCompareJump] = &&kRegisterOpCompareJumpHandler,
+      [kRegisterOpJumpIfFalse] = &&kRegisterOpJumpIfFalseHandler,
+      [kRegisterOpJump] = &&kRegisterOpJumpHandler,
+      [kRegisterOpPrint] = &&kRegisterOpPrintHandler,
+      [kRegisterOpDefineFunction] = &&kRegisterOpDefineFunctionHandler,
+      [kRegisterOpCall] = &&kRegisterOpCallHandler,
+      [kRegisterOpCallDirect] = &&kRegisterOpCallDirectHandler,
+      [kRegisterOpTailCallDirect] = &&kRegisterOpTailCallDirectHandler,
+      [kRegisterOpReturn] = &&kRegisterOpReturnHandler,
+      [kRegisterOpHalt] = &&kRegisterOpHaltHandler,
+  };
+#endif
 
-        if (kConstantTypeBoolean == stack_value.type &&
-            0 == stack_value.as.number) {
-          instruction_address = kJumpAddress;
-        }
+  size_t program_counter = 0;
+  size_t frame_base = 0;
+  unsigned char register_operand = 0;
+#ifdef __CC65__
+  StackValue* destination = NULL;
+  const StackValue* left = NULL;
+  const StackValue* right = NULL;
+#else
+  StackValue* destination = nullptr;
+  const StackValue* left = nullptr;
+  const StackValue* right = nullptr;
+#endif
 
-        break;
-      }
-      case kOpJump: {
-        const size_t kJumpAddress = instructions[instruction_address++];
+  StackValue* register_banks[kRegisterBankConstantHigh + 1];
+  register_banks[kRegisterBankGlobal] = global_variables;
+  register_banks[kRegisterBankConstant] = constant_registers;
+  register_banks[kRegisterBankFrame] = stack;
+  register_banks[kRegisterBankConstantHigh] =
+      &constant_registers[kRegisterBankSize];
+
+  LoadConstantRegisters();
+
+  call_frame_index = 0;
+  function_pool_index = 0;
+
+#ifdef VM_THREADED_DISPATCH
+  RegisterVmDispatch();
+#else
+  while (true) {
+    const RegisterOpcode kOpcode =
+        (RegisterOpcode)register_instructions[program_counter++];
+
+    switch (kOpcode) {
+#endif
+      VmCase(kRegisterOpEnter): {
+        const size_t kFrameSize = RegisterVmReadOperand();
+
+        if (kStackSize < frame_base + kFrameSize) {
+          puts("Error: Stack overflow.");
 
-        instruction_address = kJumpAddress;
+          return;
+        }
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpStoreGlobal: {
-        const size_t kIndex = instructions[instruction_address++];
+      VmCase(kRegisterOpMove): {
+        destination = VmReadRegister();
+        *destination = *VmReadRegister();
 
-        // TODO(Martin): Implement type checker.
-        // cppcheck-suppress unreadVariable
-        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
-        const VariableType kVariableType = instructions[instruction_address++];
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpAdd): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        StackValue global_variable = {};
+        destination->as.number = left->as.number + right->as.number;
+        destination->type = kConstantTypeNumber;
 
-        // cppcheck-suppress redundantInitialization
-        global_variable = Pop();
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpSubtract): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        global_variables[kIndex] = global_variable;
+        destination->as.number = left->as.number - right->as.number;
+        destination->type = kConstantTypeNumber;
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpLoadGlobal: {
-        const size_t kIndex = instructions[instruction_address++];
+      VmCase(kRegisterOpMultiply): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        // TODO(Martin): Implement type checker.
-        // cppcheck-suppress unreadVariable
-        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
-        const VariableType kVariableType = instructions[instruction_address++];
+        destination->as.number = left->as.number * right->as.number;
+        destination->type = kConstantTypeNumber;
 
-        StackValue global_variable = {};
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpDivide): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        // cppcheck-suppress redundantInitialization
-        global_variable = global_variables[kIndex];
+        if (0 == right->as.number) {
+          puts("Error: Division by zero.");
 
-        Push(global_variable);
+          return;
+        }
 
-        break;
+        destination->as.number = left->as.number / right->as.number;
+        destination->type = kConstantTypeNumber;
+
+        RegisterVmDispatch();
       }
-      case kOpStoreLocal: {
-        const size_t kIndex = instructions[instruction_address++];
+      VmCase(kRegisterOpModulo): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        // TODO(Martin): Implement type checker.
-        // cppcheck-suppress unreadVariable
-        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
-        const VariableType kVariableType = instructions[instruction_address++];
+        if (0 == right->as.number) {
+          puts("Error: Division by zero.");
 
-        const size_t kStackOffset =
-            call_frames.stack_offset[call_frame_index - 1];
+          return;
+        }
 
-        stack[kStackOffset + 1 + kIndex] = Pop();
+        destination->as.number = left->as.number % right->as.number;
+        destination->type = kConstantTypeNumber;
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpLoadLocal: {
-        const size_t kIndex = instructions[instruction_address++];
+      VmCase(kRegisterOpEquals): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        // TODO(Martin): Implement type checker.
-        // cppcheck-suppress unreadVariable
-        // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
-        const VariableType kVariableType = instructions[instruction_address++];
+        destination->as.number = left->as.number == right->as.number;
+        destination->type = kConstantTypeBoolean;
 
-        const size_t kStackOffset =
-            call_frames.stack_offset[call_frame_index - 1];
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpNotEquals): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        Push(stack[kStackOffset + 1 + kIndex]);
+        destination->as.number = left->as.number != right->as.number;
+        destination->type = kConstantTypeBoolean;
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpDefineFunction: {
-        const size_t kIndex = instructions[instruction_address++];
-        const size_t kBodyStartIndex = instructions[instruction_address++];
-        const size_t kArity = instructions[instruction_address++];
-        const VariableType kReturnType = instructions[instruction_address++];
+      VmCase(kRegisterOpGreaterThan): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        StackValue global_variable = {};
+        destination->as.number = left->as.number > right->as.number;
+        destination->type = kConstantTypeBoolean;
 
-        Function* function = &function_pool[function_pool_index];
-        function->body_start_index = kBodyStartIndex;
-        function->arity = kArity;
-        function->return_type = kReturnType;
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpGreaterThanOrEqualTo): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        ++function_pool_index;
+        destination->as.number = left->as.number >= right->as.number;
+        destination->type = kConstantTypeBoolean;
 
-        global_variable.type = kConstantTypeFunction;
-        global_variable.as.function = function;
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpLessThan): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        global_variables[kIndex] = global_variable;
+        destination->as.number = left->as.number < right->as.number;
+        destination->type = kConstantTypeBoolean;
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpCallFunction: {
-        const size_t kArity = instructions[instruction_address++];
-        const size_t kFunctionIndex = stack_index - kArity - 1;
-        StackValue stack_value = {};
+      VmCase(kRegisterOpLessThanOrEqualTo): {
+        destination = VmReadRegister();
+        left = VmReadRegister();
+        right = VmReadRegister();
 
-        // cppcheck-suppress redundantInitialization
-        stack_value = stack[kFunctionIndex];
+        destination->as.number = left->as.number <= right->as.number;
+        destination->type = kConstantTypeBoolean;
+
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpCompareJump): {
+        const Opcode kComparison = RegisterVmReadOperand();
+        size_t jump_address = 0;
+
+        left = VmReadRegister();
+        right = VmReadRegister();
+        jump_address = RegisterVmReadOperand();
 
-        PushCallFrame(stack_value.as.function);
+        if (!Compare(kComparison, left->as.number, right->as.number)) {
+          program_counter = jump_address;
+        }
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpReturn: {
-        StackValue stack_value = {};
+      VmCase(kRegisterOpJumpIfFalse): {
+        size_t jump_address = 0;
 
-        // cppcheck-suppress redundantInitialization
-        stack_value = Pop();
+        left = VmReadRegister();
+        jump_address = RegisterVmReadOperand();
 
-        PopCallFrame(&stack_value);
+        if (kConstantTypeBoolean == left->type && 0 == left->as.number) {
+          program_counter = jump_address;
+        }
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpPushCallFrame: {
-        instruction_address += 2;
+      VmCase(kRegisterOpJump): {
+        const size_t kJumpAddress = RegisterVmReadOperand();
+
+        program_counter = kJumpAddress;
 
-        break;
+        RegisterVmDispatch();
       }
-      case kOpPopCallFrame: {
-        break;
+      VmCase(kRegisterOpPrint): {
+        PrintStackValue(VmReadRegister());
+
+        RegisterVmDispatch();
       }
-      case kOpMakeArray: {
-        const size_t kElementCount = instructions[instruction_address++];
-        StackValue val;
-        size_t element = 0;
-        Array* array_instance = &array_pool[array_pool_index++];
-        StackValue array_value = {0};
-        array_value.type = kVariableTypeArray;
-        array_value.as.array = array_instance;
+      VmCase(kRegisterOpDefineFunction): {
+        Function* function = &function_pool[function_pool_index];
 
-        if (kElementCount > kArrayElementsMax) {
-          puts("Error: Array too large.");
-          return;
-        }
+        if (kFunctionPoolSize <= function_pool_index) {
+          puts("Error: Too many functions.");
 
-        if (array_pool_index >= kArrayPoolSize) {
-          puts("Error: Too many arrays.");
           return;
         }
 
-        for (element = 0; element < kElementCount; ++element) {
-          val = Pop();
-          if (val.type != kVariableTypeInt) {
-            puts("Error: Only integer are supported in arrays.");
-            return;
-          }
-          array_instance->elements[kElementCount - element - 1] = val.as.number;
-        }
-        array_instance->count = kElementCount;
+        destination = VmReadRegister();
+        function->body_start_index = RegisterVmReadOperand();
+        function->arity = RegisterVmReadOperand();
+        function->return_type = kVariableTypeUnknown;
 
-        Push(array_value);
-        break;
+        ++function_pool_index;
+
+        destination->type = kConstantTypeFunction;
+        destination->as.function = function;
+
+        RegisterVmDispatch();
       }
-      case kOpIndexArray: {
-        StackValue index;
-        StackValue array;
-        StackValue result;
+      VmCase(kRegisterOpCall): {
+        size_t first_argument = 0;
 
-        index = Pop();
-        array = Pop();
-        if (array.type != kVariableTypeArray) {
-          puts("Runtime error: Cannot index non-array.");
-          return;
-        }
+        // The result register is read again on return, four bytes in front of
+        // the return address. The arity only matters to the code generator.
+        ++program_counter;
+        left = VmReadRegister();
+        first_argument = RegisterVmReadOperand();
+        ++program_counter;
 
-        if (index.type != kVariableTypeInt) {
-          puts("Runtime error: Array index must be integer.");
-          return;
-        }
+        if (kCallFrameTableSize <= call_frame_index) {
+          puts("Error: Call stack overflow.");
 
-        if (index.as.number < 0 ||
-            (size_t)index.as.number >= array.as.array->count) {
-          puts("Runtime error: Array index out of bounds.");
           return;
         }
-        result.type = kVariableTypeInt;
-        result.as.number = array.as.array->elements[index.as.number];
 
-        Push(result);
-        break;
+        call_frames.return_address[call_frame_index] = program_counter;
+        call_frames.stack_offset[call_frame_index] = frame_base;
+        ++call_frame_index;
+
+        frame_base += first_argument;
+        register_banks[kRegisterBankFrame] = &stack[frame_base];
+        program_counter = left->as.function->body_start_index;
+
+        RegisterVmDispatch();
       }
-      case kOpStoreElement: {
-        const size_t kArrayIndex = instructions[instruction_address++];
-        StackValue value;
-        StackValue index;
-        StackValue array;
+      VmCase(kRegisterOpCallDirect): {
+        size_t body_start_index = 0;
+        size_t first_argument = 0;
 
-        value = Pop();
-        index = Pop();
-        array = global_variables[kArrayIndex];
+        // Same layout as kRegisterOpCall, with the body address in place of
+        // the function register.
+        ++program_counter;
+        body_start_index = RegisterVmReadOperand();
+        first_argument = RegisterVmReadOperand();
+        ++program_counter;
 
-        if (array.type != kVariableTypeArray || !array.as.array) {
-          puts("Runtime error: This is not an array.");
-          return;
-        }
+        if (kCallFrameTableSize <= call_frame_index) {
+          puts("Error: Call stack overflow.");
 
-        if (index.type != kVariableTypeInt) {
-          puts("Runtime error: Array index must be integer.");
           return;
         }
 
-        if (value.type != kVariableTypeInt) {
-          puts("Runtime error: Only integers can be stored in arrays.");
-          return;
-        }
+        call_frames.return_address[call_frame_index] = program_counter;
+        call_frames.stack_offset[call_frame_index] = frame_base;
+        ++call_frame_index;
 
-        if (index.as.number < 0 ||
-            (size_t)index.as.number >= array.as.array->count) {
-          puts("Runtime error: Array index out of bounds.");
-          return;
-        }
+        frame_base += first_argument;
+        register_banks[kRegisterBankFrame] = &stack[frame_base];
+        program_counter = body_start_index;
 
-        array.as.array->elements[index.as.number] = value.as.number;
-        break;
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpTailCallDirect): {
+        size_t body_start_index = 0;
+        size_t first_argument = 0;
+        size_t arity = 0;
+
+        // The arguments move down to the first registers of the current
+        // frame, which the callee then enters again.
+        body_start_index = RegisterVmReadOperand();
+        first_argument = RegisterVmReadOperand();
+        arity = RegisterVmReadOperand();
+
+        memmove(&stack[frame_base], &stack[frame_base + first_argument],
+                arity * sizeof(StackValue));
+
+        program_counter = body_start_index;
+
+        RegisterVmDispatch();
+      }
+      VmCase(kRegisterOpReturn): {
+        const StackValue kResult = *VmReadRegister();
+
+        --call_frame_index;
+
+        frame_base = call_frames.stack_offset[call_frame_index];
+        register_banks[kRegisterBankFrame] = &stack[frame_base];
+        program_counter = call_frames.return_address[call_frame_index] - 4;
+
+        *VmReadRegister() = kResult;
+        program_counter += 3;
+
+        RegisterVmDispatch();
       }
-      case kOpHalt: {
+      VmCase(kRegisterOpHalt): {
         return;
       }
-      default: {
-        printf("Error: Undefined opcode '%d'.\n", kOpcode);
+      VmDefault: {
+        printf("Error: Undefined register opcode '%d'.\n",
+               register_instructions[program_counter - 1]);
 
         return;
       }
+#ifndef VM_THREADED_DISPATCH
     }
   }
-}
\ No newline at end of file
+#endif
+}
+#ifdef __clang__
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
\ No newline at end of file
@@ -1,16 +1,44 @@
 #ifndef VM_H
 #define VM_H
 
+#ifdef __CC65__
+#include <stdbool.h>
+#endif
 #if defined(__CC65__) || defined(__linux__)
 #include <stddef.h>
 #elif __APPLE__
 #include <sys/_types/_size_t.h>
 #endif
 
+/// Size of the instruction buffer in bytes. Define VM_INSTRUCTIONS_SIZE to
+/// override the platform default.
+#ifndef VM_INSTRUCTIONS_SIZE
+#ifdef __CC65__
+#define VM_INSTRUCTIONS_SIZE 1024
+#else
+#define VM_INSTRUCTIONS_SIZE 4096
+#endif
+#endif
+
 #ifdef __CC65__
-enum { kInstructionsSize = 128 };
+enum {
+  kInstructionsSize = VM_INSTRUCTIONS_SIZE,
+  kGlobalVariablesSize = 64,
+  kFunctionPoolSize = 32,
+  kNarrowOperandMax = 255,
+  kRegisterInstructionsSize = 256,
+  kRegisterBankSize = 64,
+  kRegisterBankShift = 6
+};
 #else
-static constexpr int kInstructionsSize = 128;
+static constexpr int kInstructionsSize = VM_INSTRUCTIONS_SIZE;
+static constexpr int kGlobalVariablesSize = 1024;
+/// Each function is a global, so every program fits.
+static constexpr int kFunctionPoolSize = kGlobalVariablesSize;
+static constexpr int kNarrowOperandMax = 255;
+static constexpr int kRegisterInstructionsSize = 256;
+static constexpr int kRegisterBankSize = 64;
+static constexpr int kRegisterBankShift = 6;
 #endif
 
 typedef enum Opcode {
@@ -42,8 +70,88 @@ typedef enum Opcode {
   kOpMakeArray,
   kOpIndexArray,
   kOpStoreElement,
+  kOpLoadGlobalAddConst,
+  kOpIncGlobal,
+  kOpCompareGlobalConstJump,
+  kOpConstantWide,
+  kOpJumpIfFalseWide,
+  kOpJumpWide,
+  kOpStoreGlobalWide,
+  kOpLoadGlobalWide,
+  kOpDefineFunctionWide,
+  kOpAddInt,
+  kOpSubtractInt,
+  kOpMultiplyInt,
+  kOpDivideInt,
+  kOpModuloInt,
+  kOpEqualsInt,
+  kOpNotEqualsInt,
+  kOpGreaterThanInt,
+  kOpGreaterThanOrEqualToInt,
+  kOpLessThanInt,
+  kOpLessThanOrEqualToInt,
+  kOpJumpIfFalseBool,
+  kOpJumpIfFalseBoolWide,
+  kOpCallDirect,
+  kOpCallDirectWide,
+  kOpTailCallDirect,
+  kOpTailCallDirectWide,
+  kOpPushSmallInt,
+  kOpPushInt16,
+  kOpPushTrue,
+  kOpPushFalse,
+  kOpcodeCount
 } Opcode;
 
+/// Version of the instruction encoding. The narrow format has one-byte jump
+/// targets and function body addresses, the wide format has two-byte ones.
+/// Constant and global indices above kNarrowOperandMax use the *Wide opcodes in
+/// both formats. Wide operands are little-endian, kOpPushInt16 takes its value
+/// in two's complement.
+typedef enum BytecodeFormat {
+  kBytecodeFormatNarrow = 1,
+  kBytecodeFormatWide
+} BytecodeFormat;
+
+/// Three-address instructions of the register VM. Operands are one-byte
+/// register numbers, see RegisterBank. The arithmetic and comparison opcodes
+/// are in the same order as their stack machine counterparts.
+typedef enum RegisterOpcode {
+  kRegisterOpEnter,
+  kRegisterOpMove,
+  kRegisterOpAdd,
+  kRegisterOpSubtract,
+  kRegisterOpMultiply,
+  kRegisterOpDivide,
+  kRegisterOpModulo,
+  kRegisterOpEquals,
+  kRegisterOpNotEquals,
+  kRegisterOpGreaterThan,
+  kRegisterOpGreaterThanOrEqualTo,
+  kRegisterOpLessThan,
+  kRegisterOpLessThanOrEqualTo,
+  kRegisterOpCompareJump,
+  kRegisterOpJumpIfFalse,
+  kRegisterOpJump,
+  kRegisterOpPrint,
+  kRegisterOpDefineFunction,
+  kRegisterOpCall,
+  kRegisterOpCallDirect,
+  kRegisterOpTailCallDirect,
+  kRegisterOpReturn,
+  kRegisterOpHalt,
+  kRegisterOpcodeCount
+} RegisterOpcode;
+
+/// The top two bits of a register operand select the bank, the low six bits
+/// index into it. Constants span two banks, so all 128 of them are reachable.
+typedef enum RegisterBank {
+  kRegisterBankGlobal,
+  kRegisterBankConstant,
+  kRegisterBankFrame,
+  kRegisterBankConstantHigh
+} RegisterBank;
+
 typedef enum ConstantType {
   kConstantTypeNumber,
   kConstantTypeString,
@@ -61,11 +169,17 @@ typedef enum VariableType {
   kVariableTypeArray
 } VariableType;
 
+/// Number of operand bytes that follow each opcode in the instruction stream.
+extern const unsigned char kOperandCount[];
+
 // NOLINTBEGIN(cppcoreguidelines-avoid-non-const-global-variables)
 extern unsigned char instructions[];
 extern size_t global_variable_index;
 extern size_t instruction_address;
 extern size_t constants_index;
+extern BytecodeFormat bytecode_format;
+extern unsigned char register_instructions[];
+extern size_t register_instruction_address;
 // NOLINTEND(cppcoreguidelines-avoid-non-const-global-variables)
 
 void ResetInterpreterState();
@@ -76,12 +190,50 @@ void EmitHalt();
 
 void RemoveHalt();
 
+/// Returns the index of the constant, or (size_t)-1 if the pool is full.
 size_t AddNumberConstant(int value, ConstantType constant_type);
 
-size_t AddStringConstant(const char* string);
+/// Interns the `length` characters at `string`, which need not be terminated.
+/// Returns the index of the constant, or (size_t)-1 if the pool is full.
+size_t AddStringConstant(const char* string, size_t length);
+
+ConstantType GetConstantType(size_t index);
+
+/// Returns the value of a number or boolean constant.
+int GetNumberConstant(size_t index);
+
+/// Drops one reference to the number or boolean constant at `index`, so the
+/// parser can drop literals it folded away. The constant is freed once no
+/// literal refers to it any more, if nothing was added behind it.
+void DiscardNumberConstant(size_t index);
 
 void RunVm();
 
+/// Runs the code from `start_address` on, keeping the functions and arrays
+/// that the code in front of it created. Direct mode runs each line so.
+void RunVmFrom(size_t start_address);
+
+void RunRegisterVm();
+
 void PrintOpcodes();
 
+/// Prints how often each opcode and each pair of adjacent opcodes ran, and
+/// the time spent in each opcode, largest counts first, then resets them.
+/// Only builds with VM_PROFILE count anything, and only on the stack VM.
+void PrintProfile();
+
+/// Returns CIA 1 timer cycles on the C128 and nanoseconds natively. The
+/// profiler and the time prefix both measure with it.
+unsigned long ReadTicks();
+
+/// Writes the compiled program to the bytecode image `name`: the instructions,
+/// the register code, the constant pool and the number of globals. Functions
+/// are defined by the code itself. Returns false if the image can't be written.
+bool SaveImage(const char* name);
+
+/// Replaces the program by the one in the bytecode image `name`, which runs
+/// without being compiled. Returns false and leaves no program if the image
+/// can't be read or doesn't fit.
+bool LoadImage(const char* name);
+
 #endif  // VM_H
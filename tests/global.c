@@ -26,3 +26,24 @@ void FillProgramBufferAndParse(const char* const program) {
 
   constants_index = 0;
 }
+
+#define ADD_TEN_TIMES                                                     \
+  "s = s + i\n" "s = s + i\n" "s = s + i\n" "s = s + i\n" "s = s + i\n" \
+  "s = s + i\n" "s = s + i\n" "s = s + i\n" "s = s + i\n" "s = s + i\n"
+
+const char* const kWideLoopProgram =
+    "s: int = 0\n"
+    "i: int = 0\n"
+    "while(i < 3)\n" ADD_TEN_TIMES ADD_TEN_TIMES ADD_TEN_TIMES
+    "i = i + 1\n"
+    "endwhile";
+
+const char* const kTailCallProgram =
+    "x: int = 0\n"
+    "count: int = func(n: int, total: int)\n"
+    "if (n == 0)\n"
+    "ret total\n"
+    "endif\n"
+    "ret count(n - 1, total + 1)\n"
+    "endfunc\n"
+    "x = count(1000, 0)";
@@ -4,4 +4,10 @@
 void FillProgramBuffer(const char* program);
 void FillProgramBufferAndParse(const char* program);
 
+/// A while loop whose body is too long for one-byte jump targets.
+extern const char* const kWideLoopProgram;
+
+/// Tail recursion far deeper than the call frame table.
+extern const char* const kTailCallProgram;
+
 #endif  // GLOBAL_H
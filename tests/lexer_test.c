@@ -1,11 +1,18 @@
 #include "lexer_test.h"
 
 #include <lexer.h>
+#include <string.h>
 #include <unity.h>
 #include <vm.h>
 
 #include "global.h"
 
+/// Checks the text the current token refers to.
+static void AssertTokenText(const char* const expected) {
+  TEST_ASSERT_EQUAL_UINT(strlen(expected), token.length);
+  TEST_ASSERT_EQUAL_STRING_LEN(expected, TokenText(&token), token.length);
+}
+
 void TestUndefinedToken() {
   FillProgramBuffer("^");
 
@@ -33,7 +40,7 @@ void TestSkipWhitespace() {
   ConsumeNextToken();  // (
   ConsumeNextToken();  // 3
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(3, token.value.number);
+  TEST_ASSERT_EQUAL_INT(3, token.number);
   TEST_ASSERT_EQUAL_INT(9, program_buffer_index);
 
   ConsumeNextToken();  // +
@@ -54,14 +61,14 @@ void TestPrintArithmetic() {
 
   ConsumeNextToken();  // 3
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(3, token.value.number);
+  TEST_ASSERT_EQUAL_INT(3, token.number);
 
   ConsumeNextToken();  // +
   TEST_ASSERT_EQUAL_INT(kTokenPlus, token.type);
 
   ConsumeNextToken();  // 2
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(2, token.value.number);
+  TEST_ASSERT_EQUAL_INT(2, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -107,7 +114,7 @@ void TestString() {
 
   ConsumeNextToken();  // Hello, world!
   TEST_ASSERT_EQUAL_INT(kTokenString, token.type);
-  TEST_ASSERT_EQUAL_STRING("Hello, world!", token.value.text);
+  AssertTokenText("Hello, world!");
 }
 
 void TestPrintString() {
@@ -117,7 +124,7 @@ void TestPrintString() {
   ConsumeNextToken();  // (
   ConsumeNextToken();  // Hello, world!
   TEST_ASSERT_EQUAL_INT(kTokenString, token.type);
-  TEST_ASSERT_EQUAL_STRING("Hello, world!", token.value.text);
+  AssertTokenText("Hello, world!");
 }
 
 void TestIdentifier() {
@@ -125,7 +132,129 @@ void TestIdentifier() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
+}
+
+void TestKeywordPrefixIdentifier() {
+  FillProgramBuffer("printer iffy format trueish endwhile");
+
+  ConsumeNextToken();  // printer
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+  AssertTokenText("printer");
+
+  ConsumeNextToken();  // iffy
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+  AssertTokenText("iffy");
+
+  ConsumeNextToken();  // format
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+  AssertTokenText("format");
+
+  ConsumeNextToken();  // trueish
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+  AssertTokenText("trueish");
+
+  ConsumeNextToken();  // endwhile
+  TEST_ASSERT_EQUAL_INT(kTokenEndwhile, token.type);
+}
+
+void TestInternedIdentifier() {
+  int first_id = 0;
+
+  FillProgramBuffer("count total count counter");
+
+  ConsumeNextToken();  // count
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+  first_id = token.number;
+
+  ConsumeNextToken();  // total
+  TEST_ASSERT_NOT_EQUAL(first_id, token.number);
+
+  ConsumeNextToken();  // count
+  TEST_ASSERT_EQUAL_INT(first_id, token.number);
+  AssertTokenText("count");
+
+  ConsumeNextToken();  // counter
+  TEST_ASSERT_NOT_EQUAL(first_id, token.number);
+}
+
+void TestOtherProgramSource() {
+  static const char kSource[] = "total = \"sum\"";
+
+  FillProgramBuffer("print");
+  SetProgramSource(kSource, sizeof(kSource));
+
+  ConsumeNextToken();  // total
+  TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
+
+  ConsumeNextToken();  // =
+  ConsumeNextToken();  // "sum"
+  TEST_ASSERT_EQUAL_PTR(&kSource[9], TokenText(&token));
+
+  ConsumeNextToken();
+  TEST_ASSERT_EQUAL_INT(kTokenEof, token.type);
+
+  ResetLexerState();
+  TEST_ASSERT_EQUAL_PTR(program_buffer, program_source);
+}
+
+/// A source several times the size of the lexer's window.
+static char streamed_source[2 * kProgramBufferSize];
+
+static size_t ReadStreamedSource(const size_t position, char* const buffer,
+                                 size_t size) {
+  const size_t kLength = strlen(streamed_source);
+
+  if (kLength < position + size) {
+    size = kLength - position;
+  }
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
+  memcpy(buffer, &streamed_source[position], size);
+
+  return size;
+}
+
+void TestStreamedSource() {
+  static const char kPiece[] = "word   \"text\" 12345\n";
+  Token string = {};
+  size_t count = 0;
+
+  FillProgramBuffer("");
+
+  while (strlen(streamed_source) + sizeof(kPiece) < sizeof(streamed_source)) {
+    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.strcpy)
+    strcat(streamed_source, kPiece);
+    ++count;
+  }
+
+  SetProgramReader(ReadStreamedSource);
+  is_compile_error = false;
+
+  for (ConsumeNextToken(); kTokenEof != token.type; ConsumeNextToken()) {
+    AssertTokenText("word");
+
+    ConsumeNextToken();
+    string = token;
+
+    // The string stays readable while the token behind it is lexed.
+    ConsumeNextToken();
+    TEST_ASSERT_EQUAL_STRING_LEN("text", TokenText(&string), string.length);
+    TEST_ASSERT_EQUAL_INT(12345, token.number);
+
+    --count;
+  }
+
+  TEST_ASSERT_EQUAL_UINT(0, count);
+  TEST_ASSERT_FALSE(is_compile_error);
+
+  // Moving back to the start reads the source again.
+  program_buffer_index = 0;
+
+  ConsumeNextToken();
+  AssertTokenText("word");
+
+  ResetLexerState();
 }
 
 void TestGreaterThan() {
@@ -161,13 +290,13 @@ void TestBooleanLiteral() {
 
   ConsumeNextToken();  // true
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(1, token.value.number);
+  TEST_ASSERT_EQUAL_INT(1, token.number);
 
   FillProgramBuffer("false");
 
   ConsumeNextToken();  // false
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(0, token.value.number);
+  TEST_ASSERT_EQUAL_INT(0, token.number);
 
   FillProgramBuffer("x: bool=false");
 
@@ -177,7 +306,7 @@ void TestBooleanLiteral() {
   ConsumeNextToken();  // =
   ConsumeNextToken();  // false
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(0, token.value.number);
+  TEST_ASSERT_EQUAL_INT(0, token.number);
 }
 
 void TestIf() {
@@ -210,7 +339,7 @@ void TestNestedIf() {
 
   ConsumeNextToken();  // true
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(1, token.value.number);
+  TEST_ASSERT_EQUAL_INT(1, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -223,7 +352,7 @@ void TestNestedIf() {
 
   ConsumeNextToken();  // false
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(0, token.value.number);
+  TEST_ASSERT_EQUAL_INT(0, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -236,7 +365,7 @@ void TestNestedIf() {
 
   ConsumeNextToken();  // foo
   TEST_ASSERT_EQUAL_INT(kTokenString, token.type);
-  TEST_ASSERT_EQUAL_STRING("foo", token.value.text);
+  AssertTokenText("foo");
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -252,7 +381,7 @@ void TestNestedIf() {
 
   ConsumeNextToken();  // bar
   TEST_ASSERT_EQUAL_INT(kTokenString, token.type);
-  TEST_ASSERT_EQUAL_STRING("bar", token.value.text);
+  AssertTokenText("bar");
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -301,7 +430,7 @@ void TestIntVariableDeclaration() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -314,7 +443,7 @@ void TestIntVariableDeclaration() {
 
   ConsumeNextToken();  // 20
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(20, token.value.number);
+  TEST_ASSERT_EQUAL_INT(20, token.number);
 }
 
 void TestBoolVariableDeclaration() {
@@ -322,7 +451,7 @@ void TestBoolVariableDeclaration() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -335,7 +464,7 @@ void TestBoolVariableDeclaration() {
 
   ConsumeNextToken();  // true
   TEST_ASSERT_EQUAL_INT(kTokenBoolean, token.type);
-  TEST_ASSERT_EQUAL_INT(1, token.value.number);
+  TEST_ASSERT_EQUAL_INT(1, token.number);
 }
 
 void TestStrVariableDeclaration() {
@@ -343,7 +472,7 @@ void TestStrVariableDeclaration() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -356,7 +485,7 @@ void TestStrVariableDeclaration() {
 
   ConsumeNextToken();  // "foo"
   TEST_ASSERT_EQUAL_INT(kTokenString, token.type);
-  TEST_ASSERT_EQUAL_STRING("foo", token.value.text);
+  AssertTokenText("foo");
 }
 
 void TestFloatVariableDeclaration() {
@@ -364,7 +493,7 @@ void TestFloatVariableDeclaration() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -377,7 +506,7 @@ void TestFloatVariableDeclaration() {
 
   ConsumeNextToken();  // 2.2
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(2, token.value.number);
+  TEST_ASSERT_EQUAL_INT(2, token.number);
 }
 
 void TestVariableAssignment() {
@@ -385,14 +514,14 @@ void TestVariableAssignment() {
 
   ConsumeNextToken();  // variable
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("variable", token.value.text);
+  AssertTokenText("variable");
 
   ConsumeNextToken();  // =
   TEST_ASSERT_EQUAL_INT(kTokenAssign, token.type);
 
   ConsumeNextToken();  // 20
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(20, token.value.number);
+  TEST_ASSERT_EQUAL_INT(20, token.number);
 }
 
 void TestPrintIdentifier() {
@@ -407,7 +536,7 @@ void TestPrintIdentifier() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -418,7 +547,7 @@ void TestJumpOverNewline() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -431,7 +560,7 @@ void TestJumpOverNewline() {
 
   ConsumeNextToken();  // 5
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(5, token.value.number);
+  TEST_ASSERT_EQUAL_INT(5, token.number);
 
   ConsumeNextToken();  // print
   TEST_ASSERT_EQUAL_INT(kTokenPrint, token.type);
@@ -441,7 +570,7 @@ void TestJumpOverNewline() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -452,7 +581,7 @@ void TestFunctionDeclaration() {
 
   ConsumeNextToken();  // add
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("add", token.value.text);
+  AssertTokenText("add");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -471,7 +600,7 @@ void TestFunctionDeclaration() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -484,7 +613,7 @@ void TestFunctionDeclaration() {
 
   ConsumeNextToken();  // y
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("y", token.value.text);
+  AssertTokenText("y");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -500,14 +629,14 @@ void TestFunctionDeclaration() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // +
   TEST_ASSERT_EQUAL_INT(kTokenPlus, token.type);
 
   ConsumeNextToken();  // y
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("y", token.value.text);
+  AssertTokenText("y");
 
   ConsumeNextToken();  // endfunc
   TEST_ASSERT_EQUAL_INT(kTokenEndfunc, token.type);
@@ -519,7 +648,7 @@ void TestFunctionDeclarationPrintAndCall() {
 
   ConsumeNextToken();  // add
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("add", token.value.text);
+  AssertTokenText("add");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -538,7 +667,7 @@ void TestFunctionDeclarationPrintAndCall() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -551,7 +680,7 @@ void TestFunctionDeclarationPrintAndCall() {
 
   ConsumeNextToken();  // y
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("y", token.value.text);
+  AssertTokenText("y");
 
   ConsumeNextToken();  // :
   TEST_ASSERT_EQUAL_INT(kTokenColon, token.type);
@@ -567,14 +696,14 @@ void TestFunctionDeclarationPrintAndCall() {
 
   ConsumeNextToken();  // x
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("x", token.value.text);
+  AssertTokenText("x");
 
   ConsumeNextToken();  // +
   TEST_ASSERT_EQUAL_INT(kTokenPlus, token.type);
 
   ConsumeNextToken();  // y
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("y", token.value.text);
+  AssertTokenText("y");
 
   ConsumeNextToken();  // endfunc
   TEST_ASSERT_EQUAL_INT(kTokenEndfunc, token.type);
@@ -587,21 +716,21 @@ void TestFunctionDeclarationPrintAndCall() {
 
   ConsumeNextToken();  // add
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("add", token.value.text);
+  AssertTokenText("add");
 
   ConsumeNextToken();  // (
   TEST_ASSERT_EQUAL_INT(kTokenLeftParenthesis, token.type);
 
   ConsumeNextToken();  // 5
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(5, token.value.number);
+  TEST_ASSERT_EQUAL_INT(5, token.number);
 
   ConsumeNextToken();  // ,
   TEST_ASSERT_EQUAL_INT(kTokenComma, token.type);
 
   ConsumeNextToken();  // 6
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(6, token.value.number);
+  TEST_ASSERT_EQUAL_INT(6, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -615,21 +744,21 @@ void TestFunctionCallComma() {
 
   ConsumeNextToken();  // add
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("add", token.value.text);
+  AssertTokenText("add");
 
   ConsumeNextToken();  // (
   TEST_ASSERT_EQUAL_INT(kTokenLeftParenthesis, token.type);
 
   ConsumeNextToken();  // 5
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(5, token.value.number);
+  TEST_ASSERT_EQUAL_INT(5, token.number);
 
   ConsumeNextToken();  // ,
   TEST_ASSERT_EQUAL_INT(kTokenComma, token.type);
 
   ConsumeNextToken();  // 6
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(6, token.value.number);
+  TEST_ASSERT_EQUAL_INT(6, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -646,21 +775,21 @@ void TestFunctionCallInPrint() {
 
   ConsumeNextToken();  // add
   TEST_ASSERT_EQUAL_INT(kTokenIdentifier, token.type);
-  TEST_ASSERT_EQUAL_STRING("add", token.value.text);
+  AssertTokenText("add");
 
   ConsumeNextToken();  // (
   TEST_ASSERT_EQUAL_INT(kTokenLeftParenthesis, token.type);
 
   ConsumeNextToken();  // 5
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(5, token.value.number);
+  TEST_ASSERT_EQUAL_INT(5, token.number);
 
   ConsumeNextToken();  // ,
   TEST_ASSERT_EQUAL_INT(kTokenComma, token.type);
 
   ConsumeNextToken();  // 6
   TEST_ASSERT_EQUAL_INT(kTokenNumber, token.type);
-  TEST_ASSERT_EQUAL_INT(6, token.value.number);
+  TEST_ASSERT_EQUAL_INT(6, token.number);
 
   ConsumeNextToken();  // )
   TEST_ASSERT_EQUAL_INT(kTokenRightParenthesis, token.type);
@@ -11,6 +11,10 @@ void TestPercent();
 void TestString();
 void TestPrintString();
 void TestIdentifier();
+void TestKeywordPrefixIdentifier();
+void TestInternedIdentifier();
+void TestOtherProgramSource();
+void TestStreamedSource();
 void TestGreaterThan();
 void TestLessThan();
 void TestGreaterThanOrEqualTo();
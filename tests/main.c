@@ -25,6 +25,10 @@ int main() {
   RUN_TEST(TestString);
   RUN_TEST(TestPrintString);
   RUN_TEST(TestIdentifier);
+  RUN_TEST(TestKeywordPrefixIdentifier);
+  RUN_TEST(TestInternedIdentifier);
+  RUN_TEST(TestOtherProgramSource);
+  RUN_TEST(TestStreamedSource);
   RUN_TEST(TestGreaterThan);
   RUN_TEST(TestLessThan);
   RUN_TEST(TestGreaterThanOrEqualTo);
@@ -78,6 +82,20 @@ int main() {
   RUN_TEST(TestDeclareAndCallFunction);
   RUN_TEST(TestUnregisteredStatement);
   RUN_TEST(TestMissingLeftParen);
+  RUN_TEST(TestLoadGlobalAddConst);
+  RUN_TEST(TestIncGlobal);
+  RUN_TEST(TestCompareGlobalConstJump);
+  RUN_TEST(TestRegisterCode);
+  RUN_TEST(TestWideJumps);
+  RUN_TEST(TestBooleanConditionJump);
+  RUN_TEST(TestTypedParameters);
+  RUN_TEST(TestRecursiveFunctionCall);
+  RUN_TEST(TestTailCall);
+  RUN_TEST(TestConstantIfCondition);
+  RUN_TEST(TestConstantWhileCondition);
+  RUN_TEST(TestInt16Immediate);
+  RUN_TEST(TestInternedConstants);
+  RUN_TEST(TestParseFragment);
 
   // vm tests
   puts("");
@@ -112,14 +130,32 @@ int main() {
   RUN_TEST(Example4);
   // RUN_TEST(Example5);
   RUN_TEST(Example6);
-  // RUN_TEST(Example7);
+  RUN_TEST(Example7);
   // RUN_TEST(Example8);
-  // RUN_TEST(Example9);
-  // RUN_TEST(Example10);
+  RUN_TEST(Example9);
+  RUN_TEST(Example10);
+  RUN_TEST(TestTailCallRunsInConstantStack);
+  RUN_TEST(TestDeadBranchKeepsFunction);
+  RUN_TEST(TestConstantPoolExhaustion);
+  RUN_TEST(TestConstantPoolExhaustionFailsCompile);
+  RUN_TEST(TestManyGlobalVariables);
+  RUN_TEST(TestRunVmFromSession);
+  RUN_TEST(TestFunctionPoolLimit);
+  RUN_TEST(TestResetClearsUsedState);
+  RUN_TEST(TestImageRoundTrip);
 
   // Loops
   RUN_TEST(TestForLoopExecutesThreeTimes);
   RUN_TEST(TestWhileLoopExecutesThreeTimes);
   RUN_TEST(TestNestedWhileLoops);
+  RUN_TEST(TestSuperinstructionLoop);
+  RUN_TEST(TestWideBytecodeLoop);
+  RUN_TEST(TestRegisterVmArithmetic);
+  RUN_TEST(TestRegisterVmLoop);
+  RUN_TEST(TestRegisterVmFunctionCall);
+  RUN_TEST(TestRegisterVmRecursiveCall);
+  RUN_TEST(TestRegisterVmTailCall);
+  RUN_TEST(TestRegisterVmInt16Immediates);
+  RUN_TEST(TestRegisterVmFallsBackForArrays);
   return UNITY_END();
 }
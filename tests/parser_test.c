@@ -1,92 +1,116 @@
 #include "parser_test.h"
 
+#include <lexer.h>
+#include <parser.h>
 #include <string.h>
 #include <unity.h>
 #include <vm.h>
 
 #include "global.h"
 
-static size_t NextConstant() { return ++constants_index; }
-
+/// The right operand is a variable, so the operation is not folded.
 static void TestBinaryOperator(const char* const source_code,
+                               const unsigned char variable,
+                               const unsigned char literal,
                                const Opcode operator_opcode) {
   FillProgramBufferAndParse(source_code);
 
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,     constants_index, kOpConstant, NextConstant(),
-      operator_opcode, kOpPrint,        kOpHalt};
+      kOpPushSmallInt, variable, kOpStoreGlobal, 0, kVariableTypeInt,
+      kOpPushSmallInt, literal,  kOpLoadGlobal,  0, 0,
+      operator_opcode, kOpPrint, kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
 }
 
-void TestRecursiveArithmetic() {
-  FillProgramBufferAndParse("print(6+3*5-1/1)");
+/// Checks that the expression folded into a single immediate and left the
+/// constant pool empty.
+static void TestFoldedExpression(const char* const source_code,
+                                 const unsigned char expected) {
+  FillProgramBuffer(source_code);
+  ParseProgram();
 
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant, constants_index, kOpConstant, NextConstant(),
-      kOpConstant, NextConstant(),  kOpMultiply, kOpAdd,
-      kOpConstant, NextConstant(),  kOpConstant, NextConstant(),
-      kOpDivide,   kOpSubtract,     kOpPrint,    kOpHalt};
+      kOpPushSmallInt, expected, kOpPrint};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
+  TEST_ASSERT_EQUAL(0, constants_index);
 }
 
-void TestParenthesesArithmetic() {
-  FillProgramBufferAndParse("print((4 + 2) * (4 - 2) / 2)");
-
-  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,    constants_index, kOpConstant,    NextConstant(),
-      kOpAdd,         kOpConstant,     NextConstant(), kOpConstant,
-      NextConstant(), kOpSubtract,     kOpMultiply,    kOpConstant,
-      NextConstant(), kOpDivide,       kOpPrint,       kOpHalt};
+void TestRecursiveArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestFoldedExpression("print(6+3*5-1/1)", 20);
+}
 
-  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
-                               kInstructionsSize);
+void TestParenthesesArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestFoldedExpression("print((4 + 2) * (4 - 2) / 2)", 6);
 }
 
-void TestAddArithmetic() { TestBinaryOperator("print(5 + 10)", kOpAdd); }
+void TestAddArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(5 + x)", 10, 5, kOpAddInt);
+}
 
 void TestSubtractArithmetic() {
-  TestBinaryOperator("print(5 - 10)", kOpSubtract);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(5 - x)", 10, 5, kOpSubtractInt);
 }
 
 void TestMultiplyArithmetic() {
-  TestBinaryOperator("print(5 * 10)", kOpMultiply);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(5 * x)", 10, 5, kOpMultiplyInt);
 }
 
-void TestDivideArithmetic() { TestBinaryOperator("print(10 / 5)", kOpDivide); }
+void TestDivideArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 5\nprint(10 / x)", 5, 10, kOpDivideInt);
+}
 
-void TestModuloArithmetic() { TestBinaryOperator("print(10 % 5)", kOpModulo); }
+void TestModuloArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 5\nprint(10 % x)", 5, 10, kOpModuloInt);
+}
 
 void TestLessThanCondition() {
-  TestBinaryOperator("print(1 < 10)", kOpLessThan);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(1 < x)", 10, 1, kOpLessThanInt);
 }
 
 void TestLessOrEqualCondition() {
-  TestBinaryOperator("print(5 <= 10)", kOpLessThanOrEqualTo);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(5 <= x)", 10, 5,
+                     kOpLessThanOrEqualToInt);
 }
 
 void TestGreaterThanCondition() {
-  TestBinaryOperator("print(1 > 10)", kOpGreaterThan);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(1 > x)", 10, 1, kOpGreaterThanInt);
 }
 
 void TestGreaterOrEqualCondition() {
-  TestBinaryOperator("print(5 >= 10)", kOpGreaterThanOrEqualTo);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(5 >= x)", 10, 5,
+                     kOpGreaterThanOrEqualToInt);
 }
 
-void TestEqualCondition() { TestBinaryOperator("print(1 == 10)", kOpEquals); }
+void TestEqualCondition() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(1 == x)", 10, 1, kOpEqualsInt);
+}
 
 void TestNotEqualCondition() {
-  TestBinaryOperator("print(1 != 10)", kOpNotEquals);
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestBinaryOperator("x: int = 10\nprint(1 != x)", 10, 1, kOpNotEqualsInt);
 }
 
 void TestTrueBoolean() {
   FillProgramBufferAndParse("print(true)");
 
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant, constants_index, kOpPrint, kOpHalt};
+      kOpPushTrue, kOpPrint, kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
@@ -96,7 +120,7 @@ void TestFalseBoolean() {
   FillProgramBufferAndParse("print(false)");
 
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant, constants_index, kOpPrint, kOpHalt};
+      kOpPushFalse, kOpPrint, kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
@@ -115,9 +139,10 @@ void TestStringParse() {
 void TestDeclareIntAndPrint() {
   FillProgramBufferAndParse("x: int = 5\nprint(x)");
 
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,      constants_index, kOpStoreGlobal,  constants_index,
-      kVariableTypeInt, kOpLoadGlobal,   constants_index, kVariableTypeInt,
+      kOpPushSmallInt,  5,             kOpStoreGlobal,  constants_index,
+      kVariableTypeInt, kOpLoadGlobal, constants_index, kVariableTypeInt,
       kOpPrint,         kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
@@ -128,8 +153,7 @@ void TestDeclareBool() {
   FillProgramBufferAndParse("x: bool = true");
 
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,     constants_index,   kOpStoreGlobal,
-      constants_index, kVariableTypeBool, kOpHalt};
+      kOpPushTrue, kOpStoreGlobal, constants_index, kVariableTypeBool, kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
@@ -163,11 +187,12 @@ void TestDeclareIntAssignAndPrint() {
 
   FillProgramBufferAndParse("x: int = 5\nx = 6\nprint(x)");
 
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
   const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,       constants_index,  kOpStoreGlobal, constants_index,
-      kVariableTypeInt,  kOpConstant,      NextConstant(), kOpStoreGlobal,
-      --constants_index, kVariableTypeInt, kOpLoadGlobal,  constants_index,
-      kVariableTypeInt,  kOpPrint,         kOpHalt};
+      kOpPushSmallInt,  5,                kOpStoreGlobal, 0,
+      kVariableTypeInt, kOpPushSmallInt,  6,              kOpStoreGlobal,
+      0,                kVariableTypeInt, kOpLoadGlobal,  0,
+      kVariableTypeInt, kOpPrint,         kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
@@ -203,7 +228,7 @@ void TestDeclareIntAssignAndPrint() {
 void TestDeclareFunctionOneParameter() {
   FillProgramBufferAndParse("something: int = func(x: int)\nret x\nendfunc");
 
-  constexpr size_t kJumpAddress = 13;
+  constexpr size_t kJumpAddress = 10;
   constexpr size_t kArity = 1;
   constexpr size_t kBodyStart = 2;
 
@@ -213,9 +238,6 @@ void TestDeclareFunctionOneParameter() {
       kOpPushCallFrame,
       kArity,
       kVariableTypeInt,
-      kOpStoreLocal,
-      0,
-      kVariableTypeInt,
       kOpLoadLocal,
       0,
       kVariableTypeInt,
@@ -236,7 +258,7 @@ void TestDeclareFunctionTwoParameters() {
   FillProgramBufferAndParse(
       "add: int = func(x: int, y: int)\nret x + y\nendfunc");
 
-  constexpr size_t kJumpAddress = 20;
+  constexpr size_t kJumpAddress = 14;
   constexpr size_t kArity = 2;
   constexpr size_t kBodyStart = 2;
 
@@ -246,19 +268,13 @@ void TestDeclareFunctionTwoParameters() {
       kOpPushCallFrame,
       kArity,
       kVariableTypeInt,
-      kOpStoreLocal,
-      1,
-      kVariableTypeInt,
-      kOpStoreLocal,
-      0,
-      kVariableTypeInt,
       kOpLoadLocal,
       0,
       kVariableTypeInt,
       kOpLoadLocal,
       1,
       kVariableTypeInt,
-      kOpAdd,
+      kOpAddInt,
       kOpReturn,
       kOpReturn,
       kOpDefineFunction,
@@ -276,10 +292,12 @@ void TestDeclareAndCallFunction() {
   FillProgramBufferAndParse(
       "add: int = func(x: int, y: int)\nret x + y\nendfunc\nprint(add(5, 6))");
 
-  constexpr size_t kJumpAddress = 20;
+  constexpr size_t kJumpAddress = 14;
   constexpr size_t kArity = 2;
   constexpr size_t kFunctionIndex = 0;
   constexpr size_t kBodyStart = 2;
+  constexpr unsigned char kFirstArgument = 5;
+  constexpr unsigned char kSecondArgument = 6;
 
   constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
       kOpJump,
@@ -287,19 +305,13 @@ void TestDeclareAndCallFunction() {
       kOpPushCallFrame,
       kArity,
       kVariableTypeInt,
-      kOpStoreLocal,
-      1,
-      kVariableTypeInt,
-      kOpStoreLocal,
-      0,
-      kVariableTypeInt,
       kOpLoadLocal,
       0,
       kVariableTypeInt,
       kOpLoadLocal,
       1,
       kVariableTypeInt,
-      kOpAdd,
+      kOpAddInt,
       kOpReturn,
       kOpReturn,
       kOpDefineFunction,
@@ -307,14 +319,12 @@ void TestDeclareAndCallFunction() {
       kBodyStart,
       kArity,
       kVariableTypeInt,
-      kOpLoadGlobal,
-      kFunctionIndex,
-      kVariableTypeInt,
-      kOpConstant,
-      0,
-      kOpConstant,
-      1,
-      kOpCallFunction,
+      kOpPushSmallInt,
+      kFirstArgument,
+      kOpPushSmallInt,
+      kSecondArgument,
+      kOpCallDirect,
+      kBodyStart,
       kArity,
       kOpPrint,
       kOpHalt};
@@ -326,19 +336,309 @@ void TestDeclareAndCallFunction() {
 void TestUnregisteredStatement() {
   FillProgramBufferAndParse("prant(3+5)");
 
-  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
-      kOpConstant,    constants_index, kOpConstant,
-      NextConstant(), kOpAdd,          kOpHalt};
+  constexpr unsigned char kSum = 8;
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {kOpPushSmallInt,
+                                                             kSum, kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
 }
 
 void TestMissingLeftParen() {
-  FillProgramBufferAndParse("print3+5)");
+  FillProgramBufferAndParse("print 3+5)");
 
   constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {kOpHalt};
 
   TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
                                kInstructionsSize);
 }
+
+void TestLoadGlobalAddConst() {
+  FillProgramBufferAndParse("x: int = 1\nprint(x + 2)");
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt,
+      1,
+      kOpStoreGlobal,
+      0,
+      kVariableTypeInt,
+      kOpLoadGlobalAddConst,
+      0,
+      2,
+      kOpPrint,
+      kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestIncGlobal() {
+  FillProgramBufferAndParse("i: int = 0\ni = i + 1");
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt, 0, kOpStoreGlobal, 0, kVariableTypeInt,
+      kOpIncGlobal,    0, 1,              kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestCompareGlobalConstJump() {
+  FillProgramBufferAndParse("i: int = 0\nwhile(i < 3)\ni = i + 1\nendwhile");
+
+  constexpr size_t kLoopStart = 5;
+  constexpr size_t kLoopExit = 15;
+  constexpr unsigned char kLoopCount = 3;
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt,
+      0,
+      kOpStoreGlobal,
+      0,
+      kVariableTypeInt,
+      kOpCompareGlobalConstJump,
+      0,
+      kLoopCount,
+      kOpLessThan,
+      kLoopExit,
+      kOpIncGlobal,
+      0,
+      1,
+      kOpJump,
+      kLoopStart,
+      kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestRegisterCode() {
+  FillProgramBufferAndParse(
+      "x: int = 2\ny: int = x * 3\nif (y > x)\nprint(y)\nendif");
+
+  TEST_ASSERT_TRUE(GenerateRegisterCode());
+
+  constexpr unsigned char kFirstConstant =
+      kRegisterBankConstant << kRegisterBankShift;
+  constexpr size_t kEndIf = 16;
+
+  constexpr unsigned char kExpectedOpcodes[kRegisterInstructionsSize] = {
+      kRegisterOpEnter,
+      1,
+      kRegisterOpMove,
+      0,
+      kFirstConstant,
+      kRegisterOpMultiply,
+      1,
+      0,
+      kFirstConstant + 1,
+      kRegisterOpCompareJump,
+      kOpGreaterThan,
+      1,
+      0,
+      kEndIf,
+      kRegisterOpPrint,
+      1,
+      kRegisterOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, register_instructions,
+                               kRegisterInstructionsSize);
+}
+
+void TestWideJumps() {
+  FillProgramBufferAndParse(kWideLoopProgram);
+
+  constexpr size_t kConditionalJump = 16;
+  const size_t kLoopExit = instructions[kConditionalJump + 1] |
+                           (size_t)instructions[kConditionalJump + 2] << 8;
+
+  TEST_ASSERT_EQUAL(kBytecodeFormatWide, bytecode_format);
+  TEST_ASSERT_EQUAL(kOpJumpIfFalseBoolWide, instructions[kConditionalJump]);
+  TEST_ASSERT_EQUAL(instruction_address - 1, kLoopExit);
+  TEST_ASSERT_EQUAL(kOpHalt, instructions[kLoopExit]);
+}
+
+void TestBooleanConditionJump() {
+  FillProgramBufferAndParse("b: bool = true\nif (b)\nprint(1)\nendif");
+
+  constexpr size_t kEndIf = 12;
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushTrue,
+      kOpStoreGlobal,
+      0,
+      kVariableTypeBool,
+      kOpLoadGlobal,
+      0,
+      0,
+      kOpJumpIfFalseBool,
+      kEndIf,
+      kOpPushSmallInt,
+      1,
+      kOpPrint,
+      kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestTypedParameters() {
+  // A str parameter is no integer operand.
+  FillProgramBufferAndParse(
+      "f: int = func(s: str)\nprint(s + 1)\nret 0\nendfunc");
+
+  TEST_ASSERT_TRUE(is_compile_error);
+
+  // Arguments must be of the declared types of the parameters.
+  FillProgramBufferAndParse(
+      "f: int = func(n: int)\nret n + 1\nendfunc\nx: int = f(\"hello\")");
+
+  TEST_ASSERT_TRUE(is_compile_error);
+
+  FillProgramBufferAndParse(
+      "f: int = func(s: str, n: int)\nprint(s)\nret n + 1\nendfunc\n"
+      "x: int = f(\"hello\", 1)");
+
+  TEST_ASSERT_FALSE(is_compile_error);
+}
+
+void TestRecursiveFunctionCall() {
+  FillProgramBufferAndParse(
+      "down: int = func(n: int)\nret down(n - 1) * 2\nendfunc");
+
+  constexpr size_t kJumpAddress = 19;
+  constexpr size_t kArity = 1;
+  constexpr size_t kBodyStart = 2;
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpJump,
+      kJumpAddress,
+      kOpPushCallFrame,
+      kArity,
+      kVariableTypeInt,
+      kOpLoadLocal,
+      0,
+      kVariableTypeInt,
+      kOpPushSmallInt,
+      1,
+      kOpSubtractInt,
+      kOpCallDirect,
+      kBodyStart,
+      kArity,
+      kOpPushSmallInt,
+      2,
+      kOpMultiplyInt,
+      kOpReturn,
+      kOpReturn,
+      kOpDefineFunction,
+      0,
+      kBodyStart,
+      kArity,
+      kVariableTypeInt,
+      kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestTailCall() {
+  FillProgramBufferAndParse(
+      "down: int = func(n: int)\nret down(n - 1)\nendfunc");
+
+  constexpr size_t kJumpAddress = 15;
+  constexpr size_t kArity = 1;
+  constexpr size_t kBodyStart = 2;
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpJump,
+      kJumpAddress,
+      kOpPushCallFrame,
+      kArity,
+      kVariableTypeInt,
+      kOpLoadLocal,
+      0,
+      kVariableTypeInt,
+      kOpPushSmallInt,
+      1,
+      kOpSubtractInt,
+      kOpTailCallDirect,
+      kBodyStart,
+      kArity,
+      kOpReturn,
+      kOpDefineFunction,
+      0,
+      kBodyStart,
+      kArity,
+      kVariableTypeInt,
+      kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestConstantIfCondition() {
+  FillProgramBufferAndParse("if (1 < 2)\nprint(1)\nelse\nprint(2)\nendif");
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt, 1, kOpPrint, kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestConstantWhileCondition() {
+  FillProgramBufferAndParse("while (false)\nprint(1)\nendwhile\nprint(2)");
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt, 2, kOpPrint, kOpHalt};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
+
+void TestInt16Immediate() {
+  FillProgramBuffer("print(1000)");
+  ParseProgram();
+
+  constexpr unsigned char kLowByte = 0xE8;
+  constexpr unsigned char kHighByte = 0x03;
+
+  constexpr unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushInt16, kLowByte, kHighByte, kOpPrint};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+  TEST_ASSERT_EQUAL(0, constants_index);
+}
+
+void TestInternedConstants() {
+  FillProgramBuffer(
+      "print(\"a\")\nprint(\"b\")\nprint(\"a\")\nprint(\"b\")");
+  ParseProgram();
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpConstant, 0, kOpPrint, kOpConstant, 1, kOpPrint,
+      kOpConstant, 0, kOpPrint, kOpConstant, 1, kOpPrint};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+  TEST_ASSERT_EQUAL(2, constants_index);
+}
+
+void TestParseFragment() {
+  FillProgramBuffer("x: int = 1\n");
+  ParseProgram();
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.strcpy)
+  strcpy(&program_buffer[program_buffer_index], "x = x + 2\nprint(x)");
+
+  TEST_ASSERT_TRUE(ParseFragment());
+
+  const unsigned char kExpectedOpcodes[kInstructionsSize] = {
+      kOpPushSmallInt, 1, kOpStoreGlobal, 0, kVariableTypeInt, kOpIncGlobal,
+      0,               2, kOpLoadGlobal,  0, 0,                kOpPrint};
+
+  TEST_ASSERT_EQUAL_CHAR_ARRAY(kExpectedOpcodes, instructions,
+                               kInstructionsSize);
+}
@@ -30,5 +30,19 @@ void TestDeclareFunctionTwoParameters();
 void TestDeclareAndCallFunction();
 void TestUnregisteredStatement();
 void TestMissingLeftParen();
+void TestLoadGlobalAddConst();
+void TestIncGlobal();
+void TestCompareGlobalConstJump();
+void TestRegisterCode();
+void TestWideJumps();
+void TestBooleanConditionJump();
+void TestTypedParameters();
+void TestRecursiveFunctionCall();
+void TestTailCall();
+void TestConstantIfCondition();
+void TestConstantWhileCondition();
+void TestInt16Immediate();
+void TestInternedConstants();
+void TestParseFragment();
 
 #endif  // PARSER_TEST_H
@@ -5,6 +5,10 @@
 #elif __APPLE__
 #include <sys/_types/_size_t.h>
 #endif
+#include <lexer.h>
+#include <parser.h>
+#include <stdio.h>
+#include <string.h>
 #include <unity.h>
 #include <vm.h>
 
@@ -179,7 +183,7 @@ void Example2() {
 
   RunVm();
 
-  TEST_ASSERT_EQUAL(3, stack[stack_index].as.number);
+  TEST_ASSERT_EQUAL(3, global_variables[0].as.number);
 
   ResetInterpreterState();
 }
@@ -255,9 +259,9 @@ void Example7() {
   FillProgramBufferAndParse(
       "findGCD: int = func(a: int, b: int)\n"
       "  if(a == 0)\n"
-      "    return b\n"
+      "    ret b\n"
       "  endif\n"
-      "  return findGCD(b % a, a)\n"
+      "  ret findGCD(b % a, a)\n"
       "endfunc\n"
       "x: int = findGCD(35, 15)\n"
       "run");
@@ -273,14 +277,14 @@ void Example8() {
   FillProgramBufferAndParse(
       "isPrime: bool = func(n: int)\n"
       "  if(n <= 1)\n"
-      "    return false\n"
+      "    ret false\n"
       "  endif\n"
       "  for(i: int = 2; i < n; i = i + 1)\n"
       "    if(n % i == 0)\n"
-      "      return false\n"
+      "      ret false\n"
       "    endif\n"
       "  endfor\n"
-      "  return true\n"
+      "  ret true\n"
       "endfunc\n"
       "x: bool = isPrime(90)\n"
       "y: bool = isPrime(97)\n"
@@ -298,9 +302,9 @@ void Example9() {
   FillProgramBufferAndParse(
       "fib: int = func(n: int)\n"
       "  if(n <= 1)\n"
-      "    return n\n"
+      "    ret n\n"
       "  endif\n"
-      "  return fib(n-1) + fib(n-2)\n"
+      "  ret fib(n-1) + fib(n-2)\n"
       "endfunc\n"
       "x: int = fib(10)\n"
       "run");
@@ -316,9 +320,9 @@ void Example10() {
   FillProgramBufferAndParse(
       "factorial: int = func(n: int)\n"
       "  if(n <= 1)\n"
-      "    return 1\n"
+      "    ret 1\n"
       "  endif\n"
-      "  return n * factorial(n - 1)\n"
+      "  ret n * factorial(n - 1)\n"
       "endfunc\n"
       "x: int = factorial(5)\n"
       "run");
@@ -330,6 +334,190 @@ void Example10() {
   ResetInterpreterState();
 }
 
+void TestTailCallRunsInConstantStack() {
+  FillProgramBufferAndParse(kTailCallProgram);
+
+  RunVm();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(1000, global_variables[0].as.number);
+
+  ResetInterpreterState();
+}
+
+void TestDeadBranchKeepsFunction() {
+  FillProgramBufferAndParse(
+      "if (false)\n"
+      "  double: int = func(n: int)\n"
+      "    ret n * 2\n"
+      "  endfunc\n"
+      "endif\n"
+      "x: int = double(21)");
+
+  RunVm();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(42, global_variables[1].as.number);
+
+  ResetInterpreterState();
+}
+
+void TestConstantPoolExhaustion() {
+  int value = 0;
+
+  ResetInterpreterState();
+
+  while ((size_t)-1 != AddNumberConstant(value, kConstantTypeNumber)) {
+    ++value;
+  }
+
+  // Values that are already interned still resolve, new ones do not.
+  TEST_ASSERT_EQUAL(0, AddNumberConstant(0, kConstantTypeNumber));
+  TEST_ASSERT_EQUAL((size_t)-1, AddNumberConstant(value, kConstantTypeNumber));
+  TEST_ASSERT_EQUAL(value, constants_index);
+
+  ResetInterpreterState();
+}
+
+void TestConstantPoolExhaustionFailsCompile() {
+  static char source[kProgramBufferSize];
+  size_t length = 0;
+  int index = 0;
+
+  // Distinct strings until the string pool overflows.
+  while (length + 64 < sizeof(source)) {
+    length += (size_t)snprintf(&source[length], sizeof(source) - length,
+                               "print(\"%040d\")\n", index++);
+  }
+
+  FillProgramBuffer(source);
+
+  TEST_ASSERT_FALSE(ParseFragment());
+  TEST_ASSERT_TRUE(is_compile_error);
+
+  ResetInterpreterState();
+}
+
+#define FOUR_GLOBALS(prefix)                                         \
+  prefix "a: int = 1\n" prefix "b: int = 2\n" prefix "c: int = 3\n" \
+      prefix "d: int = 4\n"
+
+void TestManyGlobalVariables() {
+  FillProgramBufferAndParse(
+      FOUR_GLOBALS("f") FOUR_GLOBALS("g") FOUR_GLOBALS("h") FOUR_GLOBALS("i")
+          FOUR_GLOBALS("j") "x: int = fa + jd");
+
+  RunVm();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(5, global_variables[20].as.number);
+
+  ResetInterpreterState();
+}
+
+void TestRunVmFromSession() {
+  size_t code_start = 0;
+
+  FillProgramBuffer(
+      "x: int = 20\ndouble: int = func(n: int)\nret n * 2\nendfunc");
+  TEST_ASSERT_TRUE(ParseFragment());
+  EmitHalt();
+  RunVm();
+
+  RemoveHalt();
+  code_start = instruction_address;
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.strcpy)
+  strcpy(program_buffer, "y: int = double(x + 1)");
+  program_buffer_index = 0;
+
+  TEST_ASSERT_TRUE(ParseFragment());
+  EmitHalt();
+  RunVmFrom(code_start);
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(42, global_variables[2].as.number);
+
+  // A line that fails to compile leaves no code or symbols behind.
+  code_start = instruction_address;
+
+  // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.strcpy)
+  strcpy(program_buffer, "z: int = missing");
+  program_buffer_index = 0;
+
+  TEST_ASSERT_FALSE(ParseFragment());
+  TEST_ASSERT_EQUAL(code_start, instruction_address);
+  TEST_ASSERT_EQUAL(3, global_variable_index);
+
+  ResetInterpreterState();
+}
+
+void TestFunctionPoolLimit() {
+  // Each pass of the loop defines the function again, until the pool is full
+  // and the VM stops before `x = 1`.
+  FillProgramBufferAndParse(
+      "x: int = 0\ni: int = 0\nwhile(i < 2000)\nf: int = func()\nret 1\n"
+      "endfunc\ni = i + 1\nendwhile\nx = 1");
+  RunVm();
+
+  TEST_ASSERT_EQUAL(kFunctionPoolSize, function_pool_index);
+  TEST_ASSERT_EQUAL(0, global_variables[0].as.number);
+
+  ResetInterpreterState();
+}
+
+void TestResetClearsUsedState() {
+  FillProgramBufferAndParse("a: int = 7\nb: str = \"hi\"");
+  RunVm();
+
+  FillProgramBuffer("c: str = \"hi\"");
+
+  TEST_ASSERT_EQUAL(0, global_variables[0].as.number);
+  TEST_ASSERT_EQUAL(0, instructions[0]);
+
+  // A stale constant table slot would intern "hi" as the discarded constant.
+  ParseProgram();
+
+  TEST_ASSERT_EQUAL(1, constants_index);
+  TEST_ASSERT_EQUAL(1, global_variable_index);
+
+  ResetInterpreterState();
+}
+
+void TestImageRoundTrip() {
+  size_t code_size = 0;
+
+  FillProgramBuffer(
+      "x: int = 40\nadd: int = func(n: int)\nret n + 2\nendfunc\n"
+      "s: str = \"image\"\nx = add(x)");
+  ParseProgram();
+  EmitHalt();
+
+  code_size = instruction_address;
+
+  TEST_ASSERT_TRUE(SaveImage("vm_test.ybc"));
+
+  ResetInterpreterState();
+
+  TEST_ASSERT_TRUE(LoadImage("vm_test.ybc"));
+  TEST_ASSERT_EQUAL(code_size, instruction_address);
+  TEST_ASSERT_EQUAL(3, global_variable_index);
+
+  RunVm();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(42, global_variables[0].as.number);
+  TEST_ASSERT_EQUAL_STRING("image", global_variables[2].as.string);
+
+  // The loaded constants are interned again.
+  TEST_ASSERT_EQUAL(0, AddStringConstant("image", 5));
+  TEST_ASSERT_EQUAL(1, constants_index);
+
+  remove("vm_test.ybc");
+
+  ResetInterpreterState();
+}
+
 // Loops testing
 
 void TestForLoopExecutesThreeTimes(void) {
@@ -342,11 +530,14 @@ void TestForLoopExecutesThreeTimes(void) {
   int jump_count = 0;
   bool saw_jump_if_false = false;
 
-  for (size_t i = 0; i < kInstructionsSize; ++i) {
+  for (size_t i = 0; i < instruction_address;
+       i += 1 + kOperandCount[instructions[i]]) {
     if (instructions[i] == kOpPrint) {
       print_count++;
     }
-    if (instructions[i] == kOpJumpIfFalse) {
+    if (instructions[i] == kOpJumpIfFalse ||
+        instructions[i] == kOpJumpIfFalseBool ||
+        instructions[i] == kOpCompareGlobalConstJump) {
       saw_jump_if_false = true;
     }
     if (instructions[i] == kOpJump) {
@@ -377,11 +568,14 @@ void TestWhileLoopExecutesThreeTimes() {
   bool saw_jump_if_false = false;
   bool saw_jump = false;
 
-  for (size_t i = 0; i < kInstructionsSize; ++i) {
+  for (size_t i = 0; i < instruction_address;
+       i += 1 + kOperandCount[instructions[i]]) {
     if (instructions[i] == kOpPrint) {
       print_count++;
     }
-    if (instructions[i] == kOpJumpIfFalse) {
+    if (instructions[i] == kOpJumpIfFalse ||
+        instructions[i] == kOpJumpIfFalseBool ||
+        instructions[i] == kOpCompareGlobalConstJump) {
       saw_jump_if_false = true;
     }
     if (instructions[i] == kOpJump) {
@@ -419,3 +613,110 @@ void TestNestedWhileLoops() {
 
   RunVm();
 }
+
+void TestSuperinstructionLoop() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestConditionalResult(55,
+                        "s: int = 0\n"
+                        "i: int = 0\n"
+                        "while(i <= 10)\n"
+                        "  s = s + i\n"
+                        "  i = i + 1\n"
+                        "endwhile");
+}
+
+void TestWideBytecodeLoop() {
+  FillProgramBufferAndParse(kWideLoopProgram);
+  RunVm();
+
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TEST_ASSERT_EQUAL(90, global_variables[0].as.number);
+  TEST_ASSERT_FALSE(GenerateRegisterCode());
+
+  ResetInterpreterState();
+}
+
+// Register VM
+
+static void TestRegisterResult(const int expected, const size_t global_index,
+                               const char* const code) {
+  FillProgramBufferAndParse(code);
+
+  TEST_ASSERT_TRUE(GenerateRegisterCode());
+
+  RunRegisterVm();
+
+  TEST_ASSERT_EQUAL(expected, global_variables[global_index].as.number);
+
+  ResetInterpreterState();
+}
+
+void TestRegisterVmArithmetic() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(17, 1, "x: int = 4\ny: int = (2 + 3) * x - 6 / 2");
+  TestRegisterResult(1, 0, "x: bool = 3 >= 3");
+}
+
+void TestRegisterVmLoop() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(55, 0,
+                     "s: int = 0\n"
+                     "i: int = 0\n"
+                     "while(i <= 10)\n"
+                     "  s = s + i\n"
+                     "  i = i + 1\n"
+                     "endwhile");
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(20, 0,
+                     "x: int = 0\n"
+                     "if (x == 0)\n"
+                     "  x = 20\n"
+                     "else\n"
+                     "  x = 10\n"
+                     "endif");
+}
+
+void TestRegisterVmFunctionCall() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(30, 0,
+                     "b: int = 0\n"
+                     "foo: int = func(num: int)\n"
+                     "b = (num + 2) * 3\n"
+                     "ret b\n"
+                     "endfunc\n"
+                     "print(foo(8))");
+}
+
+void TestRegisterVmRecursiveCall() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(55, 0,
+                     "x: int = 0\n"
+                     "fib: int = func(n: int)\n"
+                     "if (n < 2)\n"
+                     "ret n\n"
+                     "endif\n"
+                     "ret fib(n - 1) + fib(n - 2)\n"
+                     "endfunc\n"
+                     "x = fib(10)");
+}
+
+void TestRegisterVmTailCall() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(1000, 0, kTailCallProgram);
+}
+
+void TestRegisterVmInt16Immediates() {
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestConditionalResult(-997, "x: int = 3 - 1000");
+  // NOLINTNEXTLINE(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers,-warnings-as-errors)
+  TestRegisterResult(-997, 0, "x: int = 3\nx = x - 1000");
+}
+
+void TestRegisterVmFallsBackForArrays() {
+  FillProgramBufferAndParse("a: array = $1, 2&");
+
+  TEST_ASSERT_FALSE(GenerateRegisterCode());
+  TEST_ASSERT_EQUAL(0, register_instruction_address);
+
+  ResetInterpreterState();
+}
@@ -30,10 +30,30 @@ void Example7();
 void Example8();
 void Example9();
 void Example10();
+void TestTailCallRunsInConstantStack();
+void TestDeadBranchKeepsFunction();
+void TestConstantPoolExhaustion();
+void TestConstantPoolExhaustionFailsCompile();
+void TestManyGlobalVariables();
+void TestRunVmFromSession();
+void TestFunctionPoolLimit();
+void TestResetClearsUsedState();
+void TestImageRoundTrip();
 
 // Loops
 void TestForLoopExecutesThreeTimes(void);
 void TestWhileLoopExecutesThreeTimes();
 void TestNestedWhileLoops();
+void TestSuperinstructionLoop();
+void TestWideBytecodeLoop();
+
+// Register VM
+void TestRegisterVmArithmetic();
+void TestRegisterVmLoop();
+void TestRegisterVmFunctionCall();
+void TestRegisterVmRecursiveCall();
+void TestRegisterVmTailCall();
+void TestRegisterVmInt16Immediates();
+void TestRegisterVmFallsBackForArrays();
 
 #endif  // CONDITIONALS_TEST_H